@@ -94,8 +94,8 @@
 #define LCD_5x8DOTS 0x00
 
 void lcd_init(void);
-void lcd_write_string(uint8_t x, uint8_t y, char string[]);
-void lcd_write_char(uint8_t x, uint8_t y, char val);
+uint8_t lcd_write_string(uint8_t x, uint8_t y, char string[]);
+uint8_t lcd_write_char(uint8_t x, uint8_t y, char val);
 
 
 void lcd_clear(void);
@@ -119,6 +119,10 @@ void scrollDisplayRight(void);
 
 size_t lcd_write(uint8_t);
 void lcd_command(uint8_t);
+uint8_t lcd_enqueue(uint16_t);
+uint8_t lcd_queueFree(void);
+void lcd_tick(void);
+uint8_t lcd_update(uint8_t, uint8_t, char);
 
 
 void lcd_send(uint8_t, uint8_t);
@@ -130,6 +134,39 @@ uint8_t _lcd_displayfunction;
 uint8_t _lcd_displaycontrol;
 uint8_t _lcd_displaymode;
 
+// Command queue: callers only queue commands and characters, lcd_tick()
+// clocks out one per tick of Timer0's compare A (moved on by LCD_TICK_COUNTS
+// each time, and only enabled while there is something queued or held, no
+// waiting on the LCD in it) and holds off the next one as long as the HD44780
+// takes over it. A full queue turns entries away rather than wait.
+#define LCD_QUEUE_SIZE (64) // Must be a power of 2, holds a full repaint (clear, 2 x (cursor move + 16))
+#define LCD_TICK_US (80) // Shortest gap between entries, longer than a character or command
+#define LCD_TICK_COUNTS (20) // LCD_TICK_US in Timer0 counts (prescaler 64, at 16 MHz)
+#define LCD_COMMAND_US (37) // Execution time of most commands and of a character
+#define LCD_CLEAR_US (1520) // Clear and return home
+
+// Each entry: the byte, then
+#define LCD_QUEUE_RS (0x100) // Data (RS high), not a command
+#define LCD_QUEUE_NIBBLE (0x200) // Low 4 bits only, one enable pulse (4 bit mode start up)
+#define LCD_QUEUE_HOLD_SHIFT (10) // Ticks from this entry to the next, 6 bits
+#define LCD_TICKS(us) ((us) / LCD_TICK_US + 1)
+#define LCD_HOLD(us) ((uint16_t)LCD_TICKS(us) << LCD_QUEUE_HOLD_SHIFT)
+
+volatile uint16_t _lcd_queue[LCD_QUEUE_SIZE];
+volatile uint8_t _lcd_head = 0; // Next free slot (written by the main loop)
+volatile uint8_t _lcd_tail = 0; // Next entry to clock out (written by lcd_tick)
+volatile uint16_t _lcd_hold = 0; // Ticks left before the next entry
+
+// Shadow of what DDRAM shows: lcd_write_string() and lcd_write_char() only
+// queue the characters that differ from it, and a cursor move before one
+// only where the address counter is not already there (left to right entry)
+#define LCD_ROWS (2)
+#define LCD_COLS (16)
+#define LCD_ADDRESS_UNKNOWN (0xFF)
+
+char _lcd_shadow[LCD_ROWS][LCD_COLS];
+uint8_t _lcd_address = LCD_ADDRESS_UNKNOWN; // DDRAM address the next character goes to
+
 /* ----------------- END OF LCD DEFINITIONS -------------- */
 
 
@@ -139,16 +176,41 @@ uint8_t _lcd_displaymode;
 #include <avr/io.h> 
 #include <avr/interrupt.h>
 #include <util/delay.h>
-
-void uartTransmit();
-void uartTransmitByte(unsigned char byte);
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
+
+int uartTransmit(int16_t address, uint8_t* data, uint8_t length);
+int linkTransmit(int16_t address, uint8_t sequence, uint8_t* data, uint8_t length);
+int16_t linkPoll(uint8_t address);
+int8_t ledLevel(char cell);
+void packFrame(const char* string, uint8_t* frame, uint8_t depth, const uint8_t* tile);
+uint8_t encodeFrame(uint8_t* frame, uint8_t* previous, uint8_t length, uint8_t* coded);
+uint8_t wireFrame(const char* string, uint8_t time, uint8_t tileIndex, uint8_t* previous, uint8_t* coded, uint8_t key);
+uint8_t patternDepth(const char* string);
+uint8_t patternEncoded(const char** strings, uint8_t depth, const uint8_t* tile);
+void patternName(int patternNo, char* name, uint8_t size);
+uint8_t frameTime(const char* string);
+const char* nextTimestep(const char* string);
 void uartProcess();
+void streamProcess();
+void streamStop();
 void buttonProcess();
 void prepareMessage();
 void uartSetup();
 void timerSetup();
+void reportLine(const char* line, uint8_t length);
+uint16_t profileNow();
+uint32_t profileStart(uint8_t handler);
+void profileExit(uint32_t* mark);
+void profileDump();
+uint16_t frameTicks(uint8_t code);
 void inputSetup();
 void lcdSetup();
+uint16_t baudSetting(uint32_t baud);
+void setBaud(uint8_t rate);
+void baudSend(uint8_t address, uint8_t byte);
+uint8_t baudProbe(uint8_t address);
+void baudNegotiate();
 
 // Bit operations
 #define SET_BIT(reg, pin)			(reg) |= (1 << (pin))
@@ -159,160 +221,508 @@ void lcdSetup();
 #define BIT_IS_SET(reg, pin)		(BIT_VALUE((reg),(pin))==1)
 
 // Device specs
+// Link baud rate: every device starts at BAUD, then baudNegotiate() steps it
+// up through baudRates while every slave answers its probe right
 #define BAUD	9600
+#define BAUD_RATES					7
+#define BAUD_U2X					0x8000 // From baudSetting() -> double speed (U2X0), UBRR0 in the low bits
+#define BAUD_COMMIT					0x80 // Rate change byte: keep the rate on trial (its index in the low bits)
+#define BAUD_TRIAL_MS				250 // Rate on trial not kept by then -> the slaves go back to the last one kept
+#define BAUD_PROBE_SIZE				48 // Bytes of a probe after the slave address (fits the transmit buffer)
+#define BAUD_ACK					0x06 // Answers to a probe
+#define BAUD_NAK					0x15
+#define BAUD_START_MS				100 // Slaves up before the first probe
+#define BAUD_SWITCH_US				3000 // Last two characters off the wire (UDR0 and the shift register, 2.3 ms at BAUD) and taken by every slave
+#define BAUD_ANSWER_MS				5 // Longest wait for the answer to a probe, once it is out
+#define PROBE_BYTE(i)				((uint8_t)((i) * 0x3B) ^ ((i) & 1 ? 0x55 : 0xAA)) // Byte i of a probe
 // LED Matrix display limits
-#define MAX_REFRESH_RATE			1
-#define MIN_REFRESH_RATE			3
 #define MAX_MTRX_PATTERN_STEPS		20+1+1 // +1 for header, +1 for NULL
-#define SEC_TO_OCR1A(sec)			F_CPU/1024*sec // OCR = frequency / prescalar * target_time
+#define PATTERN_SEPARATOR			';' // Between name and timesteps in a pattern string
+#define FRAME_TIME_MARK				'@' // After a timestep: "@<ms>" it is shown for
+#define FRAME_MS_DEFAULT			1000 // Timesteps without a duration
+#define FRAME_MS_MIN				10
+#define FRAME_MS_MAX				4100
+// Frame durations: one code per frame, 1 to 100 -> 10 ms steps (10 ms to 1 s),
+// 101 to 255 -> 1 s plus 20 ms steps (up to 4.1 s), as on the slaves
+#define FRAME_TIME_FINE				100
+#define FRAME_TIME_FINE_MS			10
+#define FRAME_TIME_COARSE_MS		20
+#define FRAME_TIME_FINE_END_MS		(FRAME_TIME_FINE * FRAME_TIME_FINE_MS)
+// Code of a duration in ms, to the nearest step (a constant for tables)
+#define FRAME_TIME(ms)				((ms) <= FRAME_MS_MIN ? 1 : \
+									(ms) <= FRAME_TIME_FINE_END_MS ? ((ms) + FRAME_TIME_FINE_MS / 2) / FRAME_TIME_FINE_MS : \
+									(ms) >= FRAME_MS_MAX ? 255 : \
+									FRAME_TIME_FINE + ((ms) - FRAME_TIME_FINE_END_MS + FRAME_TIME_COARSE_MS / 2) / FRAME_TIME_COARSE_MS)
+#define FRAME_TIME_DEFAULT			FRAME_TIME(FRAME_MS_DEFAULT)
+// Wire format (binary, 1 or 4 bits per LED)
+#define LINK_VERSION				5
+#define LINK_HEADER_SIZE			5 // Version, width, height, number of frames, bits per LED
+#define LINK_ENCODED				0x80 // Set in the bits per LED field -> frames are encoded
+#define LINK_TIMED					0x40 // Set in the bits per LED field -> each frame starts with its duration code
+#define LINK_STREAM					0x20 // Set in the bits per LED field -> stream, number of frames is the ring size
+#define MTRX_WIDTH					6
+#define MTRX_HEIGHT					3
+#define FRAME_BYTES(depth)			((MTRX_WIDTH*MTRX_HEIGHT*(depth) + 7) / 8)
+#define MAX_FRAME_BYTES				FRAME_BYTES(4)
+// Slave tiles: part of the matrix each slave shows, frames are cut to it before sending
+#define NUM_TILES					2
+#define TILE_FIELDS					5
+#define TILE_ADDRESS				0 // Fields: slave address (SLAVE_ADDRESS in device2.c)
+#define TILE_COL					1 // Column and row of the tile's top left LED
+#define TILE_ROW					2
+#define TILE_WIDTH					3
+#define TILE_HEIGHT					4
+#define TILE_BYTES(tile, depth)		(((tile)[TILE_WIDTH]*(tile)[TILE_HEIGHT]*(depth) + 7) / 8)
+// Frame encodings: first byte of each frame, low bits count the byte pairs after it
+#define FRAME_KEY					0x00 // Packed frame as it is
+#define FRAME_DELTA					0x40 // (byte index, XOR mask) pairs against the previous frame
+#define FRAME_RLE					0x80 // (run length, byte) pairs
+#define FRAME_PAIRS_MASK			0x3F
+// Generator packet: pattern drawn by the slaves from a few parameters
+#define SEND_GENERATORS				1 // 0 -> send the frames of every pattern
+#define LINK_GENERATOR				(0x80 | LINK_VERSION) // First byte, instead of LINK_VERSION
+#define GEN_PACKET_SIZE				9 // Marker, opcode, width, height, 3 parameters, intensity, step duration
+#define GEN_PARAMS					6 // Opcode, 3 parameters, intensity, step duration code
+#define GEN_NONE					0 // Opcodes
+#define GEN_SHIFT					1 // Column bar moving sideways: width, 1 -> left
+#define GEN_SCROLL					2 // Row bar moving up or down: thickness, 1 -> up
+#define GEN_ROTATE					3 // Column mask rotating with wrap: mask, columns per row
+#define GEN_CHASE					4 // Dots running round the border: dots, tail length
+#define GEN_SWEEP					5 // Band moving right: width, slope, 1 -> arrow head
+// Slave addressing (9-bit multi-processor mode): an address byte has the 9th bit set,
+// slaves ignore data bytes in hardware until their address or the broadcast comes
+#define LINK_BROADCAST				0x00 // Every slave
+#define LINK_NO_ADDRESS				(-1) // Data only, to the slaves already selected
+#define LINK_ADDRESS_BIT			0x100 // 9th bit of a queued byte
+#define LINK_SYNC					0xFF // Address of the frame sync: every slave takes the one byte after it
+#define LINK_STREAM_END				0xFE // Address that ends a stream: every slave holds the frame it shows
+#define LINK_BAUD					0xFD // Address of a rate change: every slave takes the one byte after it
+#define LINK_PROBE					0xFC // Address of a rate probe: the slave address, then BAUD_PROBE_SIZE bytes
+#define LINK_POLL					0xFB // Address of a poll: the slave address, the slave answers what it is missing
+#define LINK_RESUME					0xFA // Address after a sync: the slaves selected before it carry on
+#define LINK_TRACE					0xF9 // Address of a profile request: the slave address, it prints its profile
+// Units: each header, frame and generator packet goes after its own address byte,
+// as its sequence number, its bytes, then a CRC-8 of both the slaves check
+#define LINK_SEQ_HEADER				0xFF // Sequence number of a header or generator packet (a frame's is its
+									// timestep, or its place in a stream modulo 256)
+#define LINK_UNIT_MAX				(2 + 2 + MAX_FRAME_BYTES) // Sequence number, longest frame, CRC
+#define LINK_POLL_DONE				(LINK_ADDRESS_BIT | BAUD_ACK) // Answer to a poll: pattern complete (otherwise
+									// the sequence number of a unit missing, 9th bit clear)
+#define LINK_POLL_WAIT				(-2) // From linkPoll(): no answer yet
+#define LINK_POLL_COMPLETE			(-1) // From linkPoll(): slave has every unit, or does not answer
+#define LINK_POLL_PASSES			2 // Main loop passes an answer can take once the poll is off the wire
+#define LINK_POLL_TRIES				3 // Polls with no answer before the slave is taken as not there
+#define LINK_POLL_ROUNDS			40 // Polls per tile and upload before it is left as it is (line too noisy)
+#define RESEND_NONE					0 // Frames going out again after a poll: none
+#define RESEND_KEY					1 // The one missing, as a keyframe
+#define RESEND_DELTAS				2 // Deltas after it, which the slave could not take either
+// Frame sync: every slave's frame clock follows this one's Timer1
+#define FRAME_PRESCALER				1024 // Timer1, CTC with one frame per compare match (64 us ticks), as on the slaves
+#define SYNC_SIZE					2 // Address, sync byte
+#define SYNC_RESTART				0x80 // Sync byte: start the received pattern from its first frame
+#define SYNC_TICK_MASK				0x7F // Sync byte: frame count (for drift reports), or the frame of a stream
+// Streaming: patterns with more timesteps than the slaves hold are sent while they play
+#define STREAM_FRAMES				8 // Frames in each slave's ring (a power of 2, up to MAX_MTRX_PATTERN_STEPS - 2)
+// UART transmit ring buffer
+#define TX_BUFFER_SIZE				64 // Must be a power of 2
+// Interrupt profiling: Timer2 runs free as the clock, with its overflows
+// counted for 16 bit timestamps (131 ms round)
+#define ISR_PROFILE					0 // 1 -> time every interrupt handler, printed on TX at PROFILE_COMMAND
+#define PROFILE_COMMAND				'P' // From a terminal on RX (USB serial, at the link's rate): print the
+									// profile, then have every slave print its own (never a slave's answer)
+#define PROFILE_PRESCALER			32 // 2 us ticks
+#define PROFILE_TRACE_SIZE			32 // Handler runs kept, must be a power of 2
+#define PROFILE_USART_UDRE			0 // Handlers timed
+#define PROFILE_USART_RX			1
+#define PROFILE_FRAME				2
+#define PROFILE_ADC					3
+#define PROFILE_INPUT				4
+#define PROFILE_LCD					5
+#define PROFILE_HANDLERS			6
+// First line of a handler: times it up to whichever return it leaves by
+// (prologue and epilogue not counted), and is nothing at all when off
+#if ISR_PROFILE
+#define PROFILE_ISR(handler)		uint32_t profileMark __attribute__((cleanup(profileExit))) = profileStart(handler)
+#else
+#define PROFILE_ISR(handler)
+#endif
 
 // Global variables
 // UART transmitting
-static char * messagesToSend[MAX_MTRX_PATTERN_STEPS];
-static int uartStringIndex = 0;
-volatile uint8_t byteToTransmit = 0;
+static const char * messagesToSend[MAX_MTRX_PATTERN_STEPS]; // Timesteps, in program memory
+static uint8_t numFramesToSend = 0;
+static uint8_t timesToSend[MAX_MTRX_PATTERN_STEPS]; // Duration code of each timestep
+static uint8_t timedToSend = 0; // Any "@<ms>" in the pattern -> durations sent with the frames
+static uint8_t depthToSend = 1;
+static uint8_t encodeToSend[NUM_TILES]; // Per tile
+static const uint8_t * generatorToSend = NULL;
+// Stream: first timestep of a pattern too long to upload (NULL -> uploaded whole)
+static const char * streamToSend = NULL;
+static const char * streamNext = NULL; // Next timestep to send
+static uint8_t streamHeaders = 0; // Tiles sent the header so far
+static uint8_t streamTile = 0; // Tile the next frame goes to
+volatile uint8_t streamSent = 0; // Frames in every slave's ring (counted modulo 256)
+volatile uint8_t streamShown = 0; // Frame the slaves are at, moved on by the frame clock
+volatile uint8_t streamPlaying = 0; // Slaves show the stream (since its restart)
+volatile uint8_t streamTimes[STREAM_FRAMES]; // Duration code of each frame in the rings
+volatile uint16_t txBuffer[TX_BUFFER_SIZE]; // 9 bits per character
+volatile uint8_t txHead = 0; // Next free slot (written by main loop)
+volatile uint8_t txTail = 0; // Next byte to send (written by USART_UDRE_vect)
+volatile uint8_t txReselect = 0; // Sync sent since -> address again before more data
+// Frame sync, sent ahead of anything queued
+volatile uint8_t syncIndex = SYNC_SIZE; // Next character (SYNC_SIZE -> none due)
+volatile uint8_t syncByte = 0;
+volatile uint8_t syncTick = 0;
+volatile uint8_t syncRestart = 0; // Upload queued -> restart the slaves once it is out
+// Frame clock: durations of the frames the slaves show, from the last restart
+static uint8_t shownTimes[MAX_MTRX_PATTERN_STEPS];
+static uint8_t shownFrames = 0;
+static uint8_t shownFrame = 0;
+// Link rate every device has kept (index in baudRates)
+static uint8_t baudRate = 0;
+// Answers from the slaves: last one (9 bits), and how many have come in (modulo 256)
+volatile uint16_t rxAnswer = 0;
+volatile uint8_t rxAnswers = 0;
+// PROFILE_COMMAND came in -> profile printed from the main loop
+volatile uint8_t profileDue = 0;
+
+// Link rates, slowest first, and the error of each at 16 MHz (host/baud_report.c)
+// Every device divides the same clock by the same UBRR0, so the error is the
+// same at both ends of the link and cancels out; what is left is how far the
+// boards' clocks are apart. It counts against anything at the exact rate (a
+// USB serial terminal), which takes about +-1.5% with 9 data bits
+//   Baud     U2X0  UBRR0   Actual   Error
+//   9600     0     103     9615     +0.16%
+//   19200    0     51      19231    +0.16%
+//   38400    0     25      38462    +0.16%
+//   57600    1     34      57143    -0.79%
+//   76800    0     12      76923    +0.16%
+//   115200   1     16      117647   +2.12%
+//   250000   0     3       250000    0.00%
+// and no faster: above that a slave's main loop parses back-to-back uploads
+// slower than they come in and its receive queue fills (host/bench_rx.c),
+// whatever the wire carries, so a probe answered at 500000 would still
+// settle on a rate uploads are lost at
+const uint32_t baudRates[BAUD_RATES] PROGMEM = {
+	BAUD, 19200, 38400, 57600, 76800, 115200, 250000
+};
+
+// Slave tiles, side by side (must match SLAVE_ADDRESS and the matrix size of each slave)
+const uint8_t slaveTiles[NUM_TILES][TILE_FIELDS] = {
+	// Address, column, row, width, height
+	{1, 0, 0, 3, 3},
+	{2, 3, 0, 3, 3},
+};
 
-//Matrix array patterns to display
+//Matrix array patterns to display, kept in program memory
 /*
-	Dimensions: pattern number x timestep
-	For each pattern, contains header, then a array of strings,
-	ending with NULL. Cells of each row are represented by bit values
+	One string per pattern: its name, then each timestep, separated by
+	';'. Rows end with ','. Cells of each row are represented by bit
+	values, or by hex digits 0-F for the intensity of each LED (grayscale)
+	A timestep can end with "@<ms>", how long it is shown (10 ms to 4.1 s,
+	1 s without)
 	
-	Header: Name/mode (appended later from reading potentiometer input)
+	Name/mode (appended later from reading potentiometer input)
 */
-char* mtrxPatterns[][MAX_MTRX_PATTERN_STEPS] = {
-	{// Pattern 1
-		"Border Snake",
-		
-		"100000,"
-		"000000,"
-		"000001",
-		
-		"000000,"
-		"100001,"
-		"000000",
-		
-		"000001,"
-		"000000,"
-		"100000",
-		
-		"000010,"
-		"000000,"
-		"010000",
-		
-		"000100,"
-		"000000,"
-		"001000",
-		
-		"001000,"
-		"000000,"
-		"000100",
-		
-		"010000,"
-		"000000,"
-		"000010",
-		
-		NULL
-	},
-	{// Pattern 2
-		"Cross",
-		
-		"000100,"
-		"100010,"
-		"010001",
-		
-		"100010,"
-		"010001,"
-		"001000",
-		
-		"010001,"
-		"001000,"
-		"000100",
-		
-		"001000,"
-		"000100,"
-		"100010",
-		
-		NULL
-	},
-	{// Pattern 3
-		"Wipe",
-		
-		"111111,"
-		"000000,"
-		"000000",
-		
-		"000000,"
-		"111111,"
-		"000000",
-		
-		"000000,"
-		"000000,"
-		"111111",
-		
-		"000000,"
-		"000000,"
-		"000000",
-		
-		NULL
-	},
-	{// Pattern 4
-		"Wipe Horizontal",
-		
-		"100000,"
-		"100000,"
-		"100000",
-		
-		"010000,"
-		"010000,"
-		"010000",
-		
-		"001000,"
-		"001000,"
-		"001000",
-		
-		"000100,"
-		"000100,"
-		"000100",
-		
-		"000010,"
-		"000010,"
-		"000010",
-		
-		"000001,"
-		"000001,"
-		"000001",
-		
-		NULL
-	},
-	{// Pattern 5
-		"Arrow",
-		
-		"110001,"
-		"011000,"
-		"110001",
-		
-		"011000,"
-		"001100,"
-		"011000",
-		
-		"001100,"
-		"000110,"
-		"001100",
-		
-		"000110,"
-		"100011,"
-		"000110",
-		
-		"100011,"
-		"110001,"
-		"100011",
-		
-		NULL
-	}
+// Pattern 1
+const char mtrxPattern1[] PROGMEM =
+	"Border Snake;"
+	
+	"100000,"
+	"000000,"
+	"000001;"
+	
+	"000000,"
+	"100001,"
+	"000000;"
+	
+	"000001,"
+	"000000,"
+	"100000;"
+	
+	"000010,"
+	"000000,"
+	"010000;"
+	
+	"000100,"
+	"000000,"
+	"001000;"
+	
+	"001000,"
+	"000000,"
+	"000100;"
+	
+	"010000,"
+	"000000,"
+	"000010";
+
+// Pattern 2
+const char mtrxPattern2[] PROGMEM =
+	"Cross;"
+	
+	"000100,"
+	"100010,"
+	"010001;"
+	
+	"100010,"
+	"010001,"
+	"001000;"
+	
+	"010001,"
+	"001000,"
+	"000100;"
+	
+	"001000,"
+	"000100,"
+	"100010";
+
+// Pattern 3
+const char mtrxPattern3[] PROGMEM =
+	"Wipe;"
+	
+	"111111,"
+	"000000,"
+	"000000;"
+	
+	"000000,"
+	"111111,"
+	"000000;"
+	
+	"000000,"
+	"000000,"
+	"111111;"
+	
+	"000000,"
+	"000000,"
+	"000000";
+
+// Pattern 4
+const char mtrxPattern4[] PROGMEM =
+	"Wipe Horizontal;"
+	
+	"100000,"
+	"100000,"
+	"100000;"
+	
+	"010000,"
+	"010000,"
+	"010000;"
+	
+	"001000,"
+	"001000,"
+	"001000;"
+	
+	"000100,"
+	"000100,"
+	"000100;"
+	
+	"000010,"
+	"000010,"
+	"000010;"
+	
+	"000001,"
+	"000001,"
+	"000001";
+
+// Pattern 5
+const char mtrxPattern5[] PROGMEM =
+	"Arrow;"
+	
+	"110001,"
+	"011000,"
+	"110001;"
+	
+	"011000,"
+	"001100,"
+	"011000;"
+	
+	"001100,"
+	"000110,"
+	"001100;"
+	
+	"000110,"
+	"100011,"
+	"000110;"
+	
+	"100011,"
+	"110001,"
+	"100011";
+
+// Pattern 6
+const char mtrxPattern6[] PROGMEM =
+	"Gradient;"
+	
+	"13579F,"
+	"13579F,"
+	"13579F;"
+	
+	"3579F1,"
+	"3579F1,"
+	"3579F1;"
+	
+	"579F13,"
+	"579F13,"
+	"579F13;"
+	
+	"79F135,"
+	"79F135,"
+	"79F135;"
+	
+	"9F1357,"
+	"9F1357,"
+	"9F1357;"
+	
+	"F13579,"
+	"F13579,"
+	"F13579";
+
+// Pattern 7
+const char mtrxPattern7[] PROGMEM =
+	"Heartbeat;"
+	
+	"001100,"
+	"011110,"
+	"001100@100;"
+	
+	"011110,"
+	"111111,"
+	"011110@150;"
+	
+	"001100,"
+	"011110,"
+	"001100@100;"
+	
+	"000000,"
+	"001100,"
+	"000000@650";
+
+// Pattern 8 (more timesteps than the slaves hold -> streamed)
+const char mtrxPattern8[] PROGMEM =
+	"Hello;"
+	
+	"000000,"
+	"000000,"
+	"000000@150;"
+	
+	"000001,"
+	"000001,"
+	"000001@150;"
+	
+	"000010,"
+	"000011,"
+	"000010@150;"
+	
+	"000101,"
+	"000111,"
+	"000101@150;"
+	
+	"001010,"
+	"001110,"
+	"001010@150;"
+	
+	"010101,"
+	"011101,"
+	"010101@150;"
+	
+	"101011,"
+	"111011,"
+	"101011@150;"
+	
+	"010111,"
+	"110110,"
+	"010111@150;"
+	
+	"101110,"
+	"101100,"
+	"101110@150;"
+	
+	"011101,"
+	"011001,"
+	"011101@150;"
+	
+	"111010,"
+	"110010,"
+	"111011@150;"
+	
+	"110100,"
+	"100100,"
+	"110111@150;"
+	
+	"101000,"
+	"001000,"
+	"101110@150;"
+	
+	"010001,"
+	"010001,"
+	"011101@150;"
+	
+	"100010,"
+	"100010,"
+	"111011@150;"
+	
+	"000100,"
+	"000100,"
+	"110111@150;"
+	
+	"001000,"
+	"001000,"
+	"101110@150;"
+	
+	"010001,"
+	"010001,"
+	"011101@150;"
+	
+	"100011,"
+	"100010,"
+	"111011@150;"
+	
+	"000111,"
+	"000101,"
+	"110111@150;"
+	
+	"001110,"
+	"001010,"
+	"101110@150;"
+	
+	"011100,"
+	"010100,"
+	"011100@150;"
+	
+	"111000,"
+	"101000,"
+	"111000@150;"
+	
+	"110000,"
+	"010000,"
+	"110000@150;"
+	
+	"100000,"
+	"100000,"
+	"100000@150;"
+	
+	"000000,"
+	"000000,"
+	"000000@150";
+
+const char * const mtrxPatterns[] PROGMEM = {
+	mtrxPattern1, mtrxPattern2, mtrxPattern3, mtrxPattern4, mtrxPattern5, mtrxPattern6,
+	mtrxPattern7, mtrxPattern8
 };
 int numMtrxPatterns = sizeof(mtrxPatterns)/sizeof(mtrxPatterns[0]);
 
+// Generator the slaves draw each pattern with instead of receiving its
+// frames: opcode, 3 parameters, intensity and step duration (GEN_NONE -> frames sent)
+const uint8_t mtrxGenerators[][GEN_PARAMS] PROGMEM = {
+	{GEN_CHASE, 2, 0, 0, 15, FRAME_TIME(FRAME_MS_DEFAULT)},				// Border Snake: 2 dots, no tail
+	{GEN_NONE},															// Cross
+	{GEN_SCROLL, 1, 0, 0, 15, FRAME_TIME(FRAME_MS_DEFAULT)},			// Wipe: 1 row, down
+	{GEN_SHIFT, 1, 0, 0, 15, FRAME_TIME(FRAME_MS_DEFAULT)},				// Wipe Horizontal: 1 column, right
+	{GEN_SWEEP, 2, (uint8_t)-1, 1, 15, FRAME_TIME(FRAME_MS_DEFAULT)},	// Arrow: 2 columns, outer rows 1 behind
+	{GEN_NONE},															// Gradient
+	{GEN_NONE},															// Heartbeat
+	{GEN_NONE},															// Hello
+};
+
 // Inputs variables initialise
 // Check if need to transmit
 volatile int startTransmit = 0;
@@ -323,85 +733,568 @@ volatile uint16_t patternSelect = 0;
 
 /* --------------- Transmitter --------------- */
 // Process (looped)
+// Each tile gets the header and every frame, then a poll: its slave answers
+// with the first unit it is missing (dropped on a bad CRC or cut short), and
+// only that goes out again, as a keyframe, with the deltas after it the slave
+// could not take either. Then the next poll, until the slave has them all
 void uartProcess()
 {
-	static int messageIndex = 0;
-	static uint8_t uartCooldown = 0;
-	
-	// Cycle
-	if (uartCooldown) return;
-		// Stop if transmission is fully completed (including for the string)
-	if (!startTransmit && uartStringIndex == 0) return;
+	static int messageIndex = -1; // -1 -> header
+	static uint8_t tileIndex = 0; // Slave the pattern is being sent to
+	static uint8_t previous[MAX_FRAME_BYTES]; // Last frame sent, for deltas
+	static uint8_t polling = 0; // Every unit out, waiting for the slave's answer
+	static uint8_t resend = RESEND_NONE;
+	static uint8_t rounds = 0; // Polls of this tile so far
 	
-	// String to write to Transmit Buffer
-	static char* uartString;
+	if (streamToSend != NULL)
+	{
+		streamProcess();
+		return;
+	}
 	
-	// Check previous string is not still transmitting
-	if (uartStringIndex == 0)
+	// Queue as many whole frames as the transmit buffer can take,
+	// USART_UDRE_vect sends them back-to-back in the background
+	while (startTransmit)
 	{
-
-		// Transmit next timestep/string in matrix display
-		uartString = messagesToSend[messageIndex];
+		const uint8_t* tile = slaveTiles[tileIndex];
 		
-		if (messagesToSend[messageIndex] == NULL)
+		if (polling)
+		{
+			int16_t missing = linkPoll(tile[TILE_ADDRESS]);
+			if (missing == LINK_POLL_WAIT) return;
+			polling = 0;
+			
+			if (missing == LINK_POLL_COMPLETE || ++rounds > LINK_POLL_ROUNDS)
+			{
+				// Tile done - Reset back to header, for the next tile or the
+				// next upload
+				rounds = 0;
+				messageIndex = -1;
+				resend = RESEND_NONE;
+				if (++tileIndex == NUM_TILES)
+				{
+					// Every slave shows its part from the same frame boundary
+					tileIndex = 0;
+					syncRestart = 1;
+					startTransmit = 0;
+				}
+			}
+			else if (missing == LINK_SEQ_HEADER || missing >= numFramesToSend || generatorToSend != NULL)
+			{
+				// No header in: the whole pattern again, to this slave only
+				messageIndex = -1;
+				resend = RESEND_KEY;
+			}
+			else
+			{
+				messageIndex = missing;
+				resend = RESEND_KEY;
+			}
+		}
+		else if (messageIndex == -1 && generatorToSend != NULL)
+		{
+			// Pattern drawn by the slaves: opcode and parameters only, to every
+			// slave with the first tile (and to one again that missed it)
+			if (tileIndex == 0 || resend != RESEND_NONE)
+			{
+				uint8_t packet[GEN_PACKET_SIZE] = {LINK_GENERATOR, pgm_read_byte(&generatorToSend[0]), MTRX_WIDTH, MTRX_HEIGHT,
+					pgm_read_byte(&generatorToSend[1]), pgm_read_byte(&generatorToSend[2]),
+					pgm_read_byte(&generatorToSend[3]), pgm_read_byte(&generatorToSend[4]),
+					pgm_read_byte(&generatorToSend[5])};
+				int16_t address = resend != RESEND_NONE ? tile[TILE_ADDRESS] : LINK_BROADCAST;
+				if (!linkTransmit(address, LINK_SEQ_HEADER, packet, GEN_PACKET_SIZE)) return;
+			}
+			
+			resend = RESEND_NONE;
+			polling = 1;
+		}
+		else if (messageIndex == -1)
+		{
+			// Header, to the slave of the current tile only: format version,
+			// tile dimensions, number of frames and bits per LED
+			uint8_t header[LINK_HEADER_SIZE] = {LINK_VERSION, tile[TILE_WIDTH], tile[TILE_HEIGHT], numFramesToSend,
+				depthToSend | (encodeToSend[tileIndex] ? LINK_ENCODED : 0) | (timedToSend ? LINK_TIMED : 0)};
+			if (!linkTransmit(tile[TILE_ADDRESS], LINK_SEQ_HEADER, header, LINK_HEADER_SIZE)) return;
+			
+			// Receiver starts each pattern from all LEDs off
+			memset(previous, 0, sizeof(previous));
+			resend = RESEND_NONE;
+			messageIndex++;
+		}
+		else if (messagesToSend[messageIndex] == NULL)
 		{
-			// End of pattern - Reset back to start of array
-			messageIndex = 0;
-			startTransmit = 0;
-			uartString[0] = 4; // End of transmission character
-			uartString[1] = 0; // End of string
+			// End of pattern for this tile -> ask its slave what it is missing
+			polling = 1;
 		}
 		else
 		{
-			// Get ready to transmit next string
+			// Transmit this tile of the next timestep
+			uint8_t coded[2 + MAX_FRAME_BYTES];
+			uint8_t sent[MAX_FRAME_BYTES];
+			memcpy(sent, previous, sizeof(sent));
+			uint8_t length = wireFrame(messagesToSend[messageIndex], timesToSend[messageIndex], tileIndex, sent, coded,
+				resend == RESEND_KEY);
+			
+			// Going out again: stop at the first frame the slave took without
+			// the one before it (anything but a delta)
+			uint8_t delta = encodeToSend[tileIndex] && (coded[timedToSend ? 1 : 0] & ~FRAME_PAIRS_MASK) == FRAME_DELTA;
+			if (resend == RESEND_DELTAS && !delta)
+			{
+				polling = 1;
+				continue;
+			}
+			if (!linkTransmit(tile[TILE_ADDRESS], messageIndex, coded, length)) return;
+			
+			// Get ready to transmit next frame
+			memcpy(previous, sent, sizeof(previous));
+			if (resend == RESEND_KEY) resend = RESEND_DELTAS;
 			messageIndex++;
 		}
-		
 	}
-	
-	// Continue transmission
-	uartTransmit(uartString);
 }
 
-void uartTransmit(char* dataToTransmit)
+// Stream: the header to every tile, then each timestep to every tile in turn,
+// round the pattern for as long as it plays
+// A frame goes into the ring slot of the frame STREAM_FRAMES before it, so it
+// is only sent once the slaves have moved past that one: one credit per free
+// slot. The slaves move on with this device's frame clock (streamShown), which
+// gives the credits back without any return path from them
+// Streams are not polled: the first frame of each round of the rings goes as
+// a keyframe, so a slave that dropped a frame (bad CRC) only misses the
+// deltas after it until then
+void streamProcess()
 {
-    if (BIT_IS_SET(UCSR0A, UDRE0)) { // Check if buffer space is free
-		if (dataToTransmit[uartStringIndex] != 0) // If not end of string
+	static uint8_t previous[NUM_TILES][MAX_FRAME_BYTES]; // Last frame sent to each tile, for deltas
+	
+	while (1)
+	{
+		if (streamHeaders < NUM_TILES)
+		{
+			// Header, with the ring size for the number of frames
+			const uint8_t* tile = slaveTiles[streamHeaders];
+			uint8_t header[LINK_HEADER_SIZE] = {LINK_VERSION, tile[TILE_WIDTH], tile[TILE_HEIGHT], STREAM_FRAMES,
+				depthToSend | LINK_STREAM | (encodeToSend[streamHeaders] ? LINK_ENCODED : 0) | (timedToSend ? LINK_TIMED : 0)};
+			if (!linkTransmit(tile[TILE_ADDRESS], LINK_SEQ_HEADER, header, LINK_HEADER_SIZE)) return;
+			
+			memset(previous[streamHeaders], 0, MAX_FRAME_BYTES);
+			streamHeaders++;
+		}
+		else if (streamTile == 0 && (uint8_t)(streamSent - streamShown) >= STREAM_FRAMES)
 		{
-			// Transmit next byte
-			uartTransmitByte((uint8_t)(dataToTransmit[uartStringIndex]));
-			uartStringIndex++;
+			// No credit: every slot holds a frame the slaves have not shown yet
+			return;
 		}
 		else
 		{
-			// String transmission complete
-			uartTransmitByte(0);
-			uartStringIndex = 0; // -> Reset to start of string
+			// Next timestep to the current tile, after its address (tiles take turns)
+			uint8_t coded[2 + MAX_FRAME_BYTES];
+			uint8_t sent[MAX_FRAME_BYTES];
+			uint8_t time = frameTime(streamNext);
+			if (time == 0) time = FRAME_TIME_DEFAULT;
+			memcpy(sent, previous[streamTile], sizeof(sent));
+			uint8_t length = wireFrame(streamNext, time, streamTile, sent, coded, streamSent % STREAM_FRAMES == 0);
+			if (!linkTransmit(slaveTiles[streamTile][TILE_ADDRESS], streamSent, coded, length)) return;
+			memcpy(previous[streamTile], sent, sizeof(sent));
+			
+			if (++streamTile == NUM_TILES)
+			{
+				// In every ring -> on to the next timestep, the first after the last
+				streamTile = 0;
+				streamTimes[streamSent % STREAM_FRAMES] = time;
+				streamSent++;
+				streamNext = nextTimestep(streamNext);
+				if (streamNext == NULL) streamNext = streamToSend;
+				
+				if (startTransmit && streamSent == STREAM_FRAMES)
+				{
+					// Rings full -> every slave starts the stream from the same boundary
+					syncRestart = 1;
+					startTransmit = 0;
+				}
+			}
 		}
-    }
+	}
+}
+
+// End a stream: the slaves stop filling their ring and hold the frame they
+// show until the next pattern
+void streamStop()
+{
+	while (!uartTransmit(LINK_STREAM_END, NULL, 0));
+	streamToSend = NULL;
+	streamPlaying = 0;
 }
 
-// Prepare byte to transmit
-void uartTransmitByte(uint8_t byte)
+// Queue a whole frame into the transmit buffer, after an address byte
+// selecting the slaves it is for unless address is LINK_NO_ADDRESS
+// Returns 0 without queueing anything if there is not enough space for it
+int uartTransmit(int16_t address, uint8_t* data, uint8_t length)
 {
-	// Prepare to transmit
-	byteToTransmit = byte;
+	uint8_t head = txHead;
+	uint8_t used = (head - txTail) & (TX_BUFFER_SIZE - 1);
+	uint8_t needed = length + (address != LINK_NO_ADDRESS);
+	
+	// One slot always left empty to tell a full buffer from an empty one
+	if (needed > TX_BUFFER_SIZE - 1 - used) return 0;
+	
+	if (address != LINK_NO_ADDRESS)
+	{
+		txBuffer[head] = LINK_ADDRESS_BIT | (uint8_t)address;
+		head = (head + 1) & (TX_BUFFER_SIZE - 1);
+	}
+	for (uint8_t i = 0; i < length; i++)
+	{
+		txBuffer[head] = data[i];
+		head = (head + 1) & (TX_BUFFER_SIZE - 1);
+	}
+	txHead = head; // Hand the frame over to the ISR
 	
 	// Wait for space in data registry (USART_UDRE_vect)
 	SET_BIT(UCSR0B, UDRIE0);
+	return 1;
+}
+
+// Queue one unit of a pattern after the address of the slaves it is for: its
+// sequence number, its bytes, then the CRC-8 of both the slaves check it by
+// Returns 0 without queueing anything if there is not enough space for it
+int linkTransmit(int16_t address, uint8_t sequence, uint8_t* data, uint8_t length)
+{
+	uint8_t unit[LINK_UNIT_MAX];
+	uint8_t crc = _crc8_ccitt_update(0, sequence);
+	
+	unit[0] = sequence;
+	for (uint8_t i = 0; i < length; i++)
+	{
+		unit[1 + i] = data[i];
+		crc = _crc8_ccitt_update(crc, data[i]);
+	}
+	unit[1 + length] = crc;
+	return uartTransmit(address, unit, length + 2);
+}
+
+// Ask a slave which unit of the upload it is missing, once per main loop pass
+// (it answers once it has parsed everything sent before the poll)
+// Returns LINK_POLL_WAIT until it answers, then the sequence number of the
+// unit, or LINK_POLL_COMPLETE if it has them all or never answers
+int16_t linkPoll(uint8_t address)
+{
+	static uint8_t answers = 0;
+	static uint8_t waited = 0; // Passes since the poll was queued (0 -> not yet)
+	static uint8_t tries = 0;
+	
+	if (waited == 0)
+	{
+		answers = rxAnswers;
+		if (uartTransmit(LINK_POLL, &address, 1)) waited = 1;
+		return LINK_POLL_WAIT;
+	}
+	
+	if (rxAnswers == answers)
+	{
+		// Waited long enough once the poll is off the wire -> ask again
+		if (txTail != txHead || ++waited <= LINK_POLL_PASSES) return LINK_POLL_WAIT;
+		waited = 0;
+		if (++tries < LINK_POLL_TRIES) return LINK_POLL_WAIT;
+		tries = 0;
+		return LINK_POLL_COMPLETE;
+	}
+	
+	waited = 0;
+	// Garbled on the way back (9th bit set but not the answer) -> ask again
+	if ((rxAnswer & LINK_ADDRESS_BIT) && rxAnswer != LINK_POLL_DONE) return LINK_POLL_WAIT;
+	tries = 0;
+	return rxAnswer == LINK_POLL_DONE ? LINK_POLL_COMPLETE : (int16_t)rxAnswer;
 }
 
 // Transmit when USART data registry empty
 ISR(USART_UDRE_vect)
 {
-    // Send data to transmit buffer (when free)
-	UDR0 = byteToTransmit;
-	CLEAR_BIT(UCSR0B, UDRIE0); // Transmitted -> clear interrupt trigger so it does not loop
+	PROFILE_ISR(PROFILE_USART_UDRE);
+	uint16_t data;
+	
+	if (syncIndex < SYNC_SIZE)
+	{
+		// Frame sync first, it deselects every slave
+		data = syncIndex == 0 ? LINK_ADDRESS_BIT | LINK_SYNC : syncByte;
+		syncIndex++;
+		txReselect = 1;
+	}
+	else if (txTail == txHead)
+	{
+		// Buffer drained -> clear interrupt trigger so it does not loop
+		CLEAR_BIT(UCSR0B, UDRIE0);
+		return;
+	}
+	else
+	{
+		data = txBuffer[txTail];
+		if (txReselect && !(data & LINK_ADDRESS_BIT))
+		{
+			// Rest of a unit after a sync: its slaves carry on first
+			data = LINK_ADDRESS_BIT | LINK_RESUME;
+		}
+		else
+		{
+			txTail = (txTail + 1) & (TX_BUFFER_SIZE - 1);
+		}
+		txReselect = 0;
+	}
+	
+	// Send next byte to transmit buffer, 9th bit first (address flag)
+	if (data & LINK_ADDRESS_BIT) SET_BIT(UCSR0B, TXB80);
+	else CLEAR_BIT(UCSR0B, TXB80);
+	UDR0 = (uint8_t)data;
+	
+	if (txTail == txHead && syncIndex == SYNC_SIZE)
+	{
+		CLEAR_BIT(UCSR0B, UDRIE0);
+	}
+}
+
+// Frame boundary -> sync every slave's frame clock to this one
+ISR(TIMER1_COMPA_vect)
+{
+	PROFILE_ISR(PROFILE_FRAME);
+	syncByte = syncTick++ & SYNC_TICK_MASK;
+	// Restart once the whole upload is on its way (the sync goes out after it)
+	if (syncRestart && txTail == txHead)
+	{
+		syncByte |= SYNC_RESTART;
+		syncRestart = 0;
+		// Slaves show the upload from its first frame: time frames by it
+		streamPlaying = streamToSend != NULL;
+		shownFrames = generatorToSend != NULL ? 1 : streamPlaying ? 0 : numFramesToSend;
+		memcpy(shownTimes, timesToSend, shownFrames);
+		shownFrame = 0;
+	}
+	else if (streamPlaying)
+	{
+		// Stream: on to the next frame once every slave has been sent it,
+		// otherwise the slaves hold the one they show
+		if ((uint8_t)(streamSent - streamShown) > 1) streamShown++;
+	}
+	else if (++shownFrame >= shownFrames)
+	{
+		shownFrame = 0;
+	}
+	if (streamPlaying)
+	{
+		// Sync carries the frame of the stream instead of the frame count
+		syncByte = (syncByte & SYNC_RESTART) | (streamShown & SYNC_TICK_MASK);
+	}
+	syncIndex = 0;
+	SET_BIT(UCSR0B, UDRIE0);
+	
+	// Next boundary when the frame the slaves step to has been shown for its duration
+	uint8_t time = FRAME_TIME_DEFAULT;
+	if (streamPlaying) time = streamTimes[streamShown % STREAM_FRAMES];
+	else if (shownFrames) time = shownTimes[shownFrame];
+	OCR1A = frameTicks(time) - 1;
+}
+
+// Timer1 ticks of a frame duration code (0 -> shortest)
+uint16_t frameTicks(uint8_t code)
+{
+	uint16_t ms = code <= FRAME_TIME_FINE ? code * FRAME_TIME_FINE_MS :
+		FRAME_TIME_FINE_END_MS + (code - FRAME_TIME_FINE) * FRAME_TIME_COARSE_MS;
+	if (ms == 0) ms = FRAME_TIME_FINE_MS;
+	return (uint32_t)ms * (F_CPU / FRAME_PRESCALER) / 1000;
+}
+
+// Intensity of one LED cell: '0'/'1' or a hex digit 0-F
+// Returns -1 for anything else (row separators)
+int8_t ledLevel(char cell)
+{
+	if (cell >= '0' && cell <= '9') return cell - '0';
+	if (cell >= 'A' && cell <= 'F') return cell - 'A' + 10;
+	if (cell >= 'a' && cell <= 'f') return cell - 'a' + 10;
+	return -1;
+}
+
+// Pack the part of a "100000,000000,000001" timestep (in program memory)
+// inside a slave tile into depth bits per LED
+// Row by row of the tile, most significant bit first, padded to a whole byte
+void packFrame(const char* string, uint8_t* frame, uint8_t depth, const uint8_t* tile)
+{
+	uint8_t row = 0;
+	uint8_t col = 0;
+	char cell;
+	
+	memset(frame, 0, TILE_BYTES(tile, depth));
+	
+	for (int i = 0; (cell = pgm_read_byte(&string[i])) != 0 && cell != PATTERN_SEPARATOR && cell != FRAME_TIME_MARK; i++)
+	{
+		if (cell == ',') // End of row - onto next row
+		{
+			row++;
+			col = 0;
+			continue;
+		}
+		
+		int8_t level = ledLevel(cell);
+		if (level < 0) continue; // Unrecognised - ignore
+		
+		if (row >= tile[TILE_ROW] && row < tile[TILE_ROW] + tile[TILE_HEIGHT] &&
+			col >= tile[TILE_COL] && col < tile[TILE_COL] + tile[TILE_WIDTH])
+		{
+			// On/off patterns: any non zero cell is on
+			uint8_t value = depth == 1 ? (level != 0) : level >> (4 - depth);
+			uint16_t bit = ((row - tile[TILE_ROW]) * tile[TILE_WIDTH] + col - tile[TILE_COL]) * depth;
+			frame[bit >> 3] |= value << (8 - depth - (bit & 7));
+		}
+		col++;
+	}
+}
+
+// One tile of a timestep as it goes on the wire: its duration code when the
+// pattern is timed, then the frame packed depthToSend bits per LED, in
+// whichever encoding is shortest when the tile's frames are encoded
+// previous (last frame sent to the tile) becomes this frame; key -> never a
+// delta (the receiver may not be at the previous frame)
+// Returns the number of bytes written to coded (at most 2 + MAX_FRAME_BYTES)
+uint8_t wireFrame(const char* string, uint8_t time, uint8_t tileIndex, uint8_t* previous, uint8_t* coded, uint8_t key)
+{
+	const uint8_t* tile = slaveTiles[tileIndex];
+	uint8_t frame[MAX_FRAME_BYTES];
+	uint8_t length = 0;
+	
+	if (timedToSend) coded[length++] = time;
+	packFrame(string, frame, depthToSend, tile);
+	if (encodeToSend[tileIndex])
+	{
+		length += encodeFrame(frame, key ? NULL : previous, TILE_BYTES(tile, depthToSend), &coded[length]);
+	}
+	else
+	{
+		memcpy(&coded[length], frame, TILE_BYTES(tile, depthToSend));
+		length += TILE_BYTES(tile, depthToSend);
+	}
+	memcpy(previous, frame, MAX_FRAME_BYTES);
+	return length;
+}
+
+// Encode a packed frame for the wire as a keyframe, an XOR delta against
+// the previous frame (NULL -> no delta) or run-length pairs, whichever is shortest
+// Returns the number of bytes written to coded (at most 1 + length)
+uint8_t encodeFrame(uint8_t* frame, uint8_t* previous, uint8_t length, uint8_t* coded)
+{
+	uint8_t changed = 0;
+	uint8_t runs = 0;
+	uint8_t n = 0;
+	
+	// Count bytes that differ from the last frame, and runs of equal bytes
+	for (uint8_t i = 0; i < length; i++)
+	{
+		if (previous == NULL || frame[i] != previous[i]) changed++;
+		if (i == 0 || frame[i] != frame[i-1]) runs++;
+	}
+	
+	if (2*changed < length && changed <= runs && changed <= FRAME_PAIRS_MASK)
+	{
+		// Delta: only the bytes that changed (none -> frame repeats)
+		coded[n++] = FRAME_DELTA | changed;
+		for (uint8_t i = 0; i < length; i++)
+		{
+			if (frame[i] == previous[i]) continue;
+			coded[n++] = i;
+			coded[n++] = frame[i] ^ previous[i];
+		}
+	}
+	else if (2*runs < length && runs <= FRAME_PAIRS_MASK)
+	{
+		// Run-length: mostly blank or filled frames
+		coded[n++] = FRAME_RLE | runs;
+		for (uint8_t i = 0; i < length; )
+		{
+			uint8_t run = 1;
+			while (i + run < length && frame[i + run] == frame[i]) run++;
+			coded[n++] = run;
+			coded[n++] = frame[i];
+			i += run;
+		}
+	}
+	else
+	{
+		// Keyframe: packed bytes as they are
+		coded[n++] = FRAME_KEY;
+		for (uint8_t i = 0; i < length; i++)
+		{
+			coded[n++] = frame[i];
+		}
+	}
+	
+	return n;
+}
+
+// Bits per LED a pattern needs: 4 if it uses any intensity other than 0/1
+// (string: its first timestep, in program memory, up to the last)
+uint8_t patternDepth(const char* string)
+{
+	uint8_t duration = 0; // In an "@<ms>"
+	char cell;
+	
+	for (int i = 0; (cell = pgm_read_byte(&string[i])) != 0; i++)
+	{
+		if (cell == FRAME_TIME_MARK) duration = 1;
+		else if (cell == PATTERN_SEPARATOR) duration = 0;
+		else if (!duration && ledLevel(cell) > 1) return 4;
+	}
+	return 1;
+}
+
+// Whether encoding the frames of a tile makes the whole pattern shorter: the
+// encoding byte of each frame only pays off when frames repeat or barely change
+uint8_t patternEncoded(const char** strings, uint8_t depth, const uint8_t* tile)
+{
+	uint8_t previous[MAX_FRAME_BYTES] = {0};
+	uint16_t packed = 0;
+	uint16_t encoded = 0;
+	
+	for (int timestep = 0; strings[timestep] != NULL; timestep++)
+	{
+		uint8_t frame[MAX_FRAME_BYTES];
+		uint8_t coded[1 + MAX_FRAME_BYTES];
+		packFrame(strings[timestep], frame, depth, tile);
+		packed += TILE_BYTES(tile, depth);
+		encoded += encodeFrame(frame, previous, TILE_BYTES(tile, depth), coded);
+		memcpy(previous, frame, sizeof(previous));
+	}
+	return encoded < packed;
+}
+
+// Duration code of a timestep (in program memory) from its "@<ms>", 0 if it has none
+uint8_t frameTime(const char* string)
+{
+	uint16_t ms = 0;
+	char cell;
+	int i = 0;
+	
+	while ((cell = pgm_read_byte(&string[i])) != 0 && cell != PATTERN_SEPARATOR && cell != FRAME_TIME_MARK) i++;
+	if (cell != FRAME_TIME_MARK) return 0;
+	while ((cell = pgm_read_byte(&string[++i])) >= '0' && cell <= '9')
+	{
+		ms = ms * 10 + cell - '0';
+	}
+	return FRAME_TIME(ms);
+}
+
+// Timestep after a timestep or the pattern name (in program memory), NULL after the last
+const char* nextTimestep(const char* string)
+{
+	char cell;
+	
+	for (int i = 0; (cell = pgm_read_byte(&string[i])) != 0; i++)
+	{
+		if (cell == PATTERN_SEPARATOR) return &string[i + 1];
+	}
+	return NULL;
 }
 
 /* --------------- Inputs --------------- */
 void buttonProcess()
 {
+	// A stream playing ends before the next pattern goes out
+	if (streamToSend != NULL) streamStop();
 	// Prepare
 	prepareMessage(patternSelect);
 	// And then start transmitting
@@ -411,45 +1304,94 @@ void buttonProcess()
 void prepareMessage(int patternNo)
 {
 	// Get and set message to transmit
+	const char* string = pgm_read_ptr(&mtrxPatterns[patternNo]);
 	int timestep = 0;
-	char* stringAtTime;
-		// Loop through selected pattern array and
-		// put each timestep in messagesToSend
-	do
-	{
-		// Skip first string in pattern: Pattern name
-		// mtrxPatterns offset by 1
-		stringAtTime = mtrxPatterns[patternNo][timestep+1];
-		messagesToSend[timestep] = stringAtTime;
+	
+	// Loop through selected pattern string and put the start of
+	// each timestep in messagesToSend, skipping the pattern name,
+	// and its duration in timesToSend
+	timedToSend = 0;
+	for (const char* step = nextTimestep(string); step != NULL; step = nextTimestep(step))
+	{
+		uint8_t time = frameTime(step);
+		if (time != 0) timedToSend = 1;
+		if (timestep < MAX_MTRX_PATTERN_STEPS - 2)
+		{
+			messagesToSend[timestep] = step;
+			timesToSend[timestep] = time != 0 ? time : FRAME_TIME_DEFAULT;
+		}
 		timestep++;
-	} while (stringAtTime != NULL);
+	}
+	
+	// More timesteps than the slaves hold -> streamed while it plays
+	// (encoding judged on the timesteps that fit)
+	streamToSend = NULL;
+	if (timestep > MAX_MTRX_PATTERN_STEPS - 2)
+	{
+		timestep = MAX_MTRX_PATTERN_STEPS - 2;
+		streamToSend = messagesToSend[0];
+	}
 	
-	// End with EOT (end of transmission)
+	// End with NULL, frame count goes in the header
 	messagesToSend[timestep] = NULL;
+	numFramesToSend = timestep;
+	depthToSend = timestep ? patternDepth(messagesToSend[0]) : 1;
+	for (uint8_t tile = 0; tile < NUM_TILES; tile++)
+	{
+		encodeToSend[tile] = patternEncoded(messagesToSend, depthToSend, slaveTiles[tile]);
+	}
+	generatorToSend = NULL;
+	if (SEND_GENERATORS && pgm_read_byte(&mtrxGenerators[patternNo][0]) != GEN_NONE)
+	{
+		generatorToSend = mtrxGenerators[patternNo];
+		timesToSend[0] = pgm_read_byte(&generatorToSend[5]);
+		streamToSend = NULL;
+	}
+	
+	// Stream starts from its first timestep, with every ring empty
+	streamNext = streamToSend;
+	streamHeaders = 0;
+	streamTile = 0;
+	streamSent = 0;
+	streamShown = 0;
 }
 
-ISR(ADC_vect)
+// Copy a pattern's name out of program memory, for the LCD
+void patternName(int patternNo, char* name, uint8_t size)
 {
-	// Inputs to change settings
-	static uint16_t previousSelect = 0;
-	
-	// ADC Conversion Result (10bit)
-	// Ranging from 1 to num of patterns
-	patternSelect = ADC / (1023.0/numMtrxPatterns);
+	const char* string = pgm_read_ptr(&mtrxPatterns[patternNo]);
+	uint8_t i = 0;
+	char cell;
 	
-	if (patternSelect != previousSelect)
+	while (i < size - 1 && (cell = pgm_read_byte(&string[i])) != 0 && cell != PATTERN_SEPARATOR)
 	{
-		// Pattern change -> Update LCD with pattern name (first string)
-		lcd_clear();
-		lcd_write_string(0, 0, mtrxPatterns[patternSelect][0]);
-		// Save to history so that it does not clear every time
-		previousSelect = patternSelect;
+		name[i++] = cell;
 	}
+	name[i] = 0;
+}
+
+ISR(ADC_vect)
+{
+	PROFILE_ISR(PROFILE_ADC);
+	
+	// ADC Conversion Result (10bit)
+	// Ranging from 0 to num of patterns - 1, full scale included
+	// (the main loop puts its name on the LCD)
+	patternSelect = (uint32_t)ADC * numMtrxPatterns / 1024;
+}
+
+ISR(TIMER0_COMPA_vect)
+{
+	PROFILE_ISR(PROFILE_LCD);
 	
+	// Next of the LCD's queued commands, once it has taken the last
+	lcd_tick();
 }
 
 ISR(TIMER0_OVF_vect)
 {
+	PROFILE_ISR(PROFILE_INPUT);
+	
 	// ADC Start Conversion (or reset)
 	SET_BIT(ADCSRA, ADSC);
 	
@@ -472,18 +1414,240 @@ ISR(TIMER0_OVF_vect)
 	}
 }
 
+/* --------------- Link rate --------------- */
+// UBRR0 for a baud rate, with BAUD_U2X for double speed where that comes
+// closer to it (normal speed takes more samples per bit, so it wins a tie)
+uint16_t baudSetting(uint32_t baud)
+{
+	uint16_t normal = (F_CPU + 8 * baud) / (16 * baud) - 1;
+	uint16_t fast = (F_CPU + 4 * baud) / (8 * baud) - 1;
+	int32_t normalOff = F_CPU / (16UL * (normal + 1)) - baud;
+	int32_t fastOff = F_CPU / (8UL * (fast + 1)) - baud;
+	if (normalOff < 0) normalOff = -normalOff;
+	if (fastOff < 0) fastOff = -fastOff;
+	
+	if (fastOff < normalOff) return BAUD_U2X | fast;
+	return normal;
+}
+
+// Send and receive at one of baudRates
+void setBaud(uint8_t rate)
+{
+	uint16_t setting = baudSetting(pgm_read_dword(&baudRates[rate]));
+	
+	UBRR0 = setting & ~BAUD_U2X;
+	if (setting & BAUD_U2X) SET_BIT(UCSR0A, U2X0);
+	else CLEAR_BIT(UCSR0A, U2X0);
+}
+
+// Link control to every slave (address, then one byte), waiting until it is
+// off the wire and every slave has taken it
+void baudSend(uint8_t address, uint8_t byte)
+{
+	while (!uartTransmit(address, &byte, 1));
+	while (txTail != txHead) _delay_us(10);
+	_delay_us(BAUD_SWITCH_US);
+}
+
+// Probe one slave at the rate on trial: BAUD_PROBE_SIZE bytes back-to-back,
+// as patterns go out. Returns 1 if it answers they all came in right
+uint8_t baudProbe(uint8_t address)
+{
+	uint8_t probe[1 + BAUD_PROBE_SIZE];
+	uint8_t answers = rxAnswers;
+	
+	probe[0] = address;
+	for (uint8_t i = 0; i < BAUD_PROBE_SIZE; i++) probe[1 + i] = PROBE_BYTE(i);
+	while (!uartTransmit(LINK_PROBE, probe, sizeof(probe)));
+	while (txTail != txHead) _delay_us(10);
+	
+	// Last byte still on the wire, then the answer
+	for (uint8_t waited = 0; waited < BAUD_ANSWER_MS && rxAnswers == answers; waited++) _delay_ms(1);
+	return rxAnswers != answers && rxAnswer == BAUD_ACK;
+}
+
+// Step the link up from BAUD through baudRates while every slave answers a
+// probe at the next rate right (before the frame sync starts, which would
+// cut into the probes). The slaves drop a rate that fails on their own after
+// BAUD_TRIAL_MS, which is waited out here, so every device is back at the
+// last one kept
+void baudNegotiate()
+{
+	_delay_ms(BAUD_START_MS);
+	
+	for (uint8_t rate = baudRate + 1; rate < BAUD_RATES; rate++)
+	{
+		// Every slave on to the rate on trial, then this device
+		baudSend(LINK_BAUD, rate);
+		setBaud(rate);
+		
+		uint8_t good = 1;
+		for (uint8_t tile = 0; tile < NUM_TILES && good; tile++)
+		{
+			good = baudProbe(slaveTiles[tile][TILE_ADDRESS]);
+		}
+		if (!good)
+		{
+			_delay_ms(BAUD_TRIAL_MS);
+			setBaud(baudRate);
+			return;
+		}
+		
+		baudSend(LINK_BAUD, BAUD_COMMIT | rate);
+		baudRate = rate;
+	}
+}
+
+// Answer from a slave (their TX pins share one wire to RX)
+ISR(USART_RX_vect)
+{
+	PROFILE_ISR(PROFILE_USART_RX);
+	
+	// Status and 9th bit have to be read before UDR0
+	uint8_t status = UCSR0A;
+	uint8_t address = BIT_IS_SET(UCSR0B, RXB80);
+	uint8_t ch = UDR0;
+	
+	// Garbled (bad stop bit or overrun) -> no answer
+	if (status & ((1 << FE0) | (1 << DOR0))) return;
+	if (ISR_PROFILE && ch == PROFILE_COMMAND)
+	{
+		profileDue = 1;
+		return;
+	}
+	rxAnswer = (address ? LINK_ADDRESS_BIT : 0) | ch;
+	rxAnswers++;
+}
+
+/* --------------- Interrupt profiling --------------- */
+// Per handler: runs, and fewest, most and total Timer2 ticks they took
+volatile uint32_t profileRuns[PROFILE_HANDLERS];
+volatile uint16_t profileLeast[PROFILE_HANDLERS];
+volatile uint16_t profileMost[PROFILE_HANDLERS];
+volatile uint32_t profileTotal[PROFILE_HANDLERS];
+// Trace ring: the last PROFILE_TRACE_SIZE runs of any handler, in order,
+// the next one written at profileHead
+volatile uint8_t profileTraceHandler[PROFILE_TRACE_SIZE];
+volatile uint16_t profileTraceStart[PROFILE_TRACE_SIZE];
+volatile uint16_t profileTraceTicks[PROFILE_TRACE_SIZE];
+volatile uint8_t profileHead = 0;
+volatile uint8_t profileTraced = 0; // Runs in the ring (up to PROFILE_TRACE_SIZE)
+volatile uint8_t profileWraps = 0; // Timer2 overflows
+volatile uint8_t profilePaused = 0; // Being printed -> handlers not recorded
+const char* const profileNames[PROFILE_HANDLERS] = {"UDRE", "RX", "FRAME", "ADC", "INPUT", "LCD"};
+
+// Timer2 ticks, with its overflows in the high byte
+// Interrupts are off in a handler: an overflow not counted yet is still
+// pending, seen as a count that has only just wrapped
+uint16_t profileNow()
+{
+	uint8_t count = TCNT2;
+	uint8_t wraps = profileWraps;
+	
+	if (BIT_IS_SET(TIFR2, TOV2) && count < 0x80) wraps++;
+	return ((uint16_t)wraps << 8) | count;
+}
+
+// Handler starting: its number in the high bits, the time in the low bits
+uint32_t profileStart(uint8_t handler)
+{
+	return ((uint32_t)handler << 16) | profileNow();
+}
+
+// Handler leaving (cleanup of PROFILE_ISR's mark): into its figures and the
+// trace ring
+void profileExit(uint32_t* mark)
+{
+	uint8_t handler = *mark >> 16;
+	uint16_t start = *mark;
+	uint16_t ticks = profileNow() - start;
+	
+	if (profilePaused) return;
+	if (profileRuns[handler] == 0 || ticks < profileLeast[handler]) profileLeast[handler] = ticks;
+	if (ticks > profileMost[handler]) profileMost[handler] = ticks;
+	profileRuns[handler]++;
+	profileTotal[handler] += ticks;
+	
+	profileTraceHandler[profileHead] = handler;
+	profileTraceStart[profileHead] = start;
+	profileTraceTicks[profileHead] = ticks;
+	profileHead = (profileHead + 1) & (PROFILE_TRACE_SIZE - 1);
+	if (profileTraced < PROFILE_TRACE_SIZE) profileTraced++;
+}
+
+#if ISR_PROFILE
+ISR(TIMER2_OVF_vect)
+{
+	profileWraps++;
+}
+#endif
+
+// Line of text on TX, between units: each character goes as an address byte
+// of no slave, so every slave drops it (the 9th bit reads as an extra stop
+// bit on an 8N1 terminal)
+void reportLine(const char* line, uint8_t length)
+{
+	for (uint8_t i = 0; i < length; i++)
+	{
+		while (!uartTransmit(line[i], NULL, 0));
+	}
+}
+
+// Profile on TX, then start it over: a line per handler "<name> <runs>
+// <least> <most> <mean>" in CPU cycles, then the trace ring oldest first,
+// "<name> <start> <cycles>" with the start in Timer2 ticks
+// Then every slave is asked for its own, which it prints on its USB serial
+void profileDump()
+{
+	char line[56]; // Longest: a handler line with four 10 digit figures
+	
+	profilePaused = 1;
+	reportLine(line, sprintf(line, "ISR master: runs least most mean\r\n"));
+	for (uint8_t handler = 0; handler < PROFILE_HANDLERS; handler++)
+	{
+		uint32_t runs = profileRuns[handler];
+		reportLine(line, sprintf(line, "%s %lu %lu %lu %lu\r\n", profileNames[handler], (unsigned long)runs,
+			(unsigned long)profileLeast[handler] * PROFILE_PRESCALER,
+			(unsigned long)profileMost[handler] * PROFILE_PRESCALER,
+			runs ? (unsigned long)(profileTotal[handler] * PROFILE_PRESCALER / runs) : 0UL));
+	}
+	for (uint8_t i = 0; i < profileTraced; i++)
+	{
+		uint8_t entry = (profileHead - profileTraced + i) & (PROFILE_TRACE_SIZE - 1);
+		reportLine(line, sprintf(line, "%s %u %lu\r\n", profileNames[profileTraceHandler[entry]],
+			profileTraceStart[entry], (unsigned long)profileTraceTicks[entry] * PROFILE_PRESCALER));
+	}
+	
+	memset((void*)profileRuns, 0, sizeof(profileRuns));
+	memset((void*)profileMost, 0, sizeof(profileMost));
+	memset((void*)profileTotal, 0, sizeof(profileTotal));
+	profileTraced = 0;
+	profilePaused = 0;
+	
+	for (uint8_t tile = 0; tile < NUM_TILES; tile++)
+	{
+		uint8_t address = slaveTiles[tile][TILE_ADDRESS];
+		while (!uartTransmit(LINK_TRACE, &address, 1));
+	}
+}
+
 /* --------------- Initialise --------------- */
 void uartSetup()
 {
-    UBRR0 = F_CPU / 16 / BAUD - 1;
     UCSR0A = 0;
+    setBaud(baudRate);
 	
 	// Interrupts
     SET_BIT(UCSR0B, TXEN0);
+	// Answers from the slaves, line pulled up while none of them drives it
+	SET_BIT(PORTD, 0); // RX pin (PD0)
+	uint8_t mask = (1 << RXEN0) | (1 << RXCIE0);
+    SET_BITS(UCSR0B, mask);
 	
-	// Character size
-	uint8_t mask = (1 << UCSZ00) | (1 << UCSZ01) | (1 << UCSZ02);
+	// Character size: 9 bits, the 9th marks slave address bytes
+	mask = (1 << UCSZ00) | (1 << UCSZ01);
     SET_BITS(UCSR0C, mask);
+    SET_BIT(UCSR0B, UCSZ02);
 }
 
 void timerSetup()
@@ -493,6 +1657,23 @@ void timerSetup()
 	SET_BIT(TCCR0B, CS01);
 	
 	SET_BIT(TIMSK0, TOIE0); // Timer/Counter0 Overflow Interrupt Enable
+	
+	// Frame clock for the slaves' sync: CTC, TOP = OCR1A (duration of the
+	// frame shown), prescaler 1024 (FRAME_PRESCALER)
+	SET_BIT(TCCR1B, WGM12);
+	SET_BIT(TCCR1B, CS10);
+	SET_BIT(TCCR1B, CS12);
+	SET_BIT(TIMSK1, OCIE1A);
+	OCR1A = frameTicks(FRAME_TIME_DEFAULT) - 1;
+	
+	// Interrupt profiling clock (ISR_PROFILE): normal, free running, the
+	// overflow interrupt counts its rounds, prescaler 32 (PROFILE_PRESCALER)
+	if (ISR_PROFILE)
+	{
+		SET_BIT(TCCR2B, CS20);
+		SET_BIT(TCCR2B, CS21);
+		SET_BIT(TIMSK2, TOIE2);
+	}
 }
 
 // Setup timer and enable interrupt
@@ -512,18 +1693,55 @@ void inputSetup()
 /* --------------- Main --------------- */
 int main() {
     uartSetup();
+	sei();
+	// Fastest link rate every slave takes, before the frame sync starts
+	baudNegotiate();
 	timerSetup();
 	inputSetup();
-	lcd_init(); // LCD setup from library (lecture notes)
+	lcd_init(); // LCD setup from library (lecture notes), clocked out by Timer0
 	
-	sei();
+	// Link rate on the second line, until the first pattern name
+	char line[17];
+	sprintf(line, "Baud %lu", (unsigned long)pgm_read_dword(&baudRates[baudRate]));
+	lcd_write_string(0, 1, line);
+	uint16_t nameShown = 0;
+	uint8_t baudShown = 1;
 	
     while (1)
 	{
 		uartProcess();
 		
+		// Pattern change -> Update LCD with pattern name (first string),
+		// over the last one (only the characters that differ go out); the
+		// link rate on the second line is blanked with the first name only
+		uint16_t select = patternSelect;
+		if (select != nameShown)
+		{
+			char name[17];
+			patternName(select, name, sizeof(name));
+			sprintf(line, "%-16s", name);
+			uint8_t queued = lcd_write_string(0, 0, line);
+			if (queued && baudShown)
+			{
+				memset(line, ' ', 16);
+				queued = lcd_write_string(0, 1, line);
+				baudShown = !queued;
+			}
+			// Save to history so that it does not rewrite every time
+			// (LCD queue full: the rest goes out on a later pass)
+			if (queued) nameShown = select;
+		}
+		
+		// Profile asked for on a terminal
+		if (ISR_PROFILE && profileDue)
+		{
+			profileDue = 0;
+			profileDump();
+		}
+		
 		// Debounced button pressed -> start transmitting
-		if (switch_closed && !startTransmit)
+		// (not while the last upload waits for its restart, which reads the frame durations)
+		if (switch_closed && !startTransmit && !syncRestart)
 		{
 			// Button event
 			buttonProcess();
@@ -579,7 +1797,8 @@ void lcd_init(void){
 
   // according to datasheet, we need at least 40ms after power rises above 2.7V
   // before sending commands. Arduino can turn on way before 4.5V so we'll wait 50
-  _delay_us(50000); 
+  // (the queue holds off its first entry, lcd_tick() sends it)
+  _lcd_hold = LCD_TICKS(50000);
   // Now we pull both RS and Enable low to begin commands (R/W is wired to ground)
   LCD_RS_PORT &= ~(1 << LCD_RS_PIN);
   LCD_ENABLE_PORT &= ~(1 << LCD_ENABLE_PIN);
@@ -590,30 +1809,25 @@ void lcd_init(void){
     // figure 24, pg 46
 
     // we start in 8bit mode, try to set 4 bit mode
-    lcd_write4bits(0b0111);
-    _delay_us(4500); // wait min 4.1ms
+    lcd_enqueue(LCD_QUEUE_NIBBLE | 0b0111 | LCD_HOLD(4100)); // wait min 4.1ms
 
     // second try
-    lcd_write4bits(0b0111);
-    _delay_us(4500); // wait min 4.1ms
+    lcd_enqueue(LCD_QUEUE_NIBBLE | 0b0111 | LCD_HOLD(4100)); // wait min 4.1ms
     
     // third go!
-    lcd_write4bits(0b0111); 
-    _delay_us(150);
+    lcd_enqueue(LCD_QUEUE_NIBBLE | 0b0111 | LCD_HOLD(100));
 
     // finally, set to 4-bit interface
-    lcd_write4bits(0b0010); 
+    lcd_enqueue(LCD_QUEUE_NIBBLE | 0b0010 | LCD_HOLD(LCD_COMMAND_US));
   } else {
     // this is according to the hitachi HD44780 datasheet
     // page 45 figure 23
 
     // Send function set command sequence
-    lcd_command(LCD_FUNCTIONSET | _lcd_displayfunction);
-    _delay_us(4500);  // wait more than 4.1ms
+    lcd_enqueue(LCD_FUNCTIONSET | _lcd_displayfunction | LCD_HOLD(4100)); // wait more than 4.1ms
 
     // second try
-    lcd_command(LCD_FUNCTIONSET | _lcd_displayfunction);
-    _delay_us(150);
+    lcd_enqueue(LCD_FUNCTIONSET | _lcd_displayfunction | LCD_HOLD(100));
 
     // third go
     lcd_command(LCD_FUNCTIONSET | _lcd_displayfunction);
@@ -637,26 +1851,52 @@ void lcd_init(void){
 
 
 /********** high level commands, for the user! */
-void lcd_write_string(uint8_t x, uint8_t y, char string[]){
-  lcd_setCursor(x,y);
+// 0: the queue filled up before the end, call again with the same string
+// to queue the rest
+uint8_t lcd_write_string(uint8_t x, uint8_t y, char string[]){
+  uint8_t queued = 1;
   for(int i=0; string[i]!='\0'; ++i){
-    lcd_write(string[i]);
+    queued &= lcd_update(x+i, y, string[i]);
   }
+  return queued;
+}
+
+uint8_t lcd_write_char(uint8_t x, uint8_t y, char val){
+  return lcd_update(x, y, val);
 }
 
-void lcd_write_char(uint8_t x, uint8_t y, char val){
-  lcd_setCursor(x,y);
+// Write one character unless the shadow shows it there already
+// (off the 16 columns shown: dropped; queue full: 0, shadow left as it was)
+uint8_t lcd_update(uint8_t col, uint8_t row, char val){
+  if ( row >= LCD_ROWS ) {
+    row = LCD_ROWS - 1;
+  }
+  if ( col >= LCD_COLS || _lcd_shadow[row][col] == val ) {
+    return 1;
+  }
+  if ( lcd_queueFree() < 2 ) {
+    return 0; // room for a cursor move and the character, or neither
+  }
+
+  if ( _lcd_address != col + row*0x40 ) {
+    lcd_setCursor(col,row);
+  }
   lcd_write(val);
+  _lcd_shadow[row][col] = val;
+  return 1;
 }
 
 void lcd_clear(void){
-  lcd_command(LCD_CLEARDISPLAY);  // clear display, set cursor position to zero
-  _delay_us(2000);  // this command takes a long time!
+  // clear display, set cursor position to zero
+  lcd_enqueue(LCD_CLEARDISPLAY | LCD_HOLD(LCD_CLEAR_US));  // this command takes a long time!
+  memset(_lcd_shadow, ' ', sizeof(_lcd_shadow));
+  _lcd_address = 0;
 }
 
 void lcd_home(void){
-  lcd_command(LCD_RETURNHOME);  // set cursor position to zero
-  _delay_us(2000);  // this command takes a long time!
+  // set cursor position to zero
+  lcd_enqueue(LCD_RETURNHOME | LCD_HOLD(LCD_CLEAR_US));  // this command takes a long time!
+  _lcd_address = 0;
 }
 
 
@@ -665,6 +1905,7 @@ void lcd_home(void){
 void lcd_createChar(uint8_t location, uint8_t charmap[]) {
   location &= 0x7; // we only have 8 locations 0-7
   lcd_command(LCD_SETCGRAMADDR | (location << 3));
+  _lcd_address = LCD_ADDRESS_UNKNOWN; // writes go to CGRAM until the next cursor move
   for (int i=0; i<8; i++) {
     lcd_write(charmap[i]);
   }
@@ -677,6 +1918,7 @@ void lcd_setCursor(uint8_t col, uint8_t row){
   }
   
   lcd_command(LCD_SETDDRAMADDR | (col + row*0x40));
+  _lcd_address = col + row*0x40;
 }
 
 // Turn the display on/off (quickly)
@@ -744,13 +1986,65 @@ void lcd_noAutoscroll(void) {
 /*********** mid level commands, for sending data/cmds */
 
 inline void lcd_command(uint8_t value) {
-  //
-  lcd_send(value, 0);
+  lcd_enqueue(value | LCD_HOLD(LCD_COMMAND_US));
 }
 
 inline size_t lcd_write(uint8_t value) {
-  lcd_send(value, 1);
-  return 1; // assume sucess
+  if (!lcd_enqueue(LCD_QUEUE_RS | value | LCD_HOLD(LCD_COMMAND_US))) {
+    return 0; // queue full
+  }
+  // the address counter moves on to the right, other entry modes are not followed
+  if (_lcd_address != LCD_ADDRESS_UNKNOWN && _lcd_displaymode == (LCD_ENTRYLEFT | LCD_ENTRYSHIFTDECREMENT)) {
+    _lcd_address++;
+  } else {
+    _lcd_address = LCD_ADDRESS_UNKNOWN;
+  }
+  return 1;
+}
+
+/************ command queue **********/
+
+// Queue a command, character or start up nibble (main loop only: 0 with the
+// queue full, nothing queued), and start the tick if it has stopped
+uint8_t lcd_enqueue(uint16_t entry) {
+  uint8_t head = _lcd_head;
+  uint8_t next = (head + 1) & (LCD_QUEUE_SIZE - 1);
+
+  if (next == _lcd_tail) return 0;
+  _lcd_queue[head] = entry;
+  _lcd_head = next; // Hand it over to the tick
+  if (!BIT_IS_SET(TIMSK0, OCIE0A)) {
+    OCR0A = TCNT0 + LCD_TICK_COUNTS;
+    SET_BIT(TIMSK0, OCIE0A);
+  }
+  return 1;
+}
+
+// Entries lcd_enqueue() takes before it turns them away
+uint8_t lcd_queueFree(void) {
+  return (_lcd_tail - _lcd_head - 1) & (LCD_QUEUE_SIZE - 1);
+}
+
+// Clock out the next entry once the last one has had its time (Timer0
+// compare A: a byte is two enable pulses, a few us), the next tick
+// LCD_TICK_COUNTS on from now; stops with nothing queued or held
+void lcd_tick(void) {
+  OCR0A = TCNT0 + LCD_TICK_COUNTS;
+  if (_lcd_hold && --_lcd_hold) return;
+  if (_lcd_tail == _lcd_head) {
+    CLEAR_BIT(TIMSK0, OCIE0A);
+    return;
+  }
+
+  uint16_t entry = _lcd_queue[_lcd_tail];
+  _lcd_tail = (_lcd_tail + 1) & (LCD_QUEUE_SIZE - 1);
+  if (entry & LCD_QUEUE_NIBBLE) {
+    LCD_RS_PORT &= ~(1 << LCD_RS_PIN);
+    lcd_write4bits(entry);
+  } else {
+    lcd_send(entry, !!(entry & LCD_QUEUE_RS));
+  }
+  _lcd_hold = entry >> LCD_QUEUE_HOLD_SHIFT;
 }
 
 /************ low level data pushing commands **********/
@@ -776,7 +2070,7 @@ void lcd_pulseEnable(void) {
   LCD_ENABLE_PORT |= (1 << LCD_ENABLE_PIN);
   _delay_us(1);    // enable pulse must be >450ns
   LCD_ENABLE_PORT &= ~(1 << LCD_ENABLE_PIN);
-  _delay_us(100);   // commands need > 37us to settle
+  // commands need > 37us to settle: held off by the queue (LCD_COMMAND_US)
 }
 
 void lcd_write4bits(uint8_t value) {
@@ -1,18 +1,49 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <avr/io.h> 
 #include <avr/interrupt.h>
 #include <util/delay.h>
+#include <util/crc16.h>
+#include <avr/sleep.h>
+#include <avr/pgmspace.h>
 
 void setupLEDs();
 void setupTimers();
 void setupUART();
-void blinkLED(int rowPin, int colPin);
-void OCRAUpdate();
-void turnOnLEDs();
+void opacityUpdate();
 void clearLEDs();
-void processUARTByte();
+void uartProcess();
+void processUARTByte(uint8_t byte);
+void unitStart();
+uint8_t headerTaken();
+uint8_t frameTaken();
+void pollAnswer();
+void unpackByte(uint8_t index, uint8_t byte, uint8_t delta);
+uint8_t rxBuffer();
+void storeFrame(int timestep);
+uint8_t generatorPeriod();
+uint8_t generatorLit(uint8_t row, uint8_t col, uint8_t step);
+void startGenerator(uint8_t* packet);
+void renderGenerator();
+uint16_t frameTicks(uint8_t code);
+void loadFrameTime();
+void frameStep();
+void syncFrame(uint8_t sync);
+void swapPattern();
+void restartPattern();
+void streamSeek();
+void reportDrift();
+void reportLine(const char* line, uint8_t length);
+uint16_t profileNow();
+uint32_t profileStart(uint8_t handler);
+void profileExit(uint32_t* mark);
+void profileDump();
+uint16_t baudSetting(uint32_t baud);
+void setBaud(uint8_t rate);
+void baudChange(uint8_t change);
+uint8_t probeByte(uint8_t byte);
 // TESTING ONLY DELETE LATER
 void uart_putbyte(unsigned char data);
 
@@ -25,7 +56,86 @@ void uart_putbyte(unsigned char data);
 #define BIT_IS_SET(reg, pin)	    (BIT_VALUE((reg),(pin))==1) 
 
 // Device specs
+// Link baud rate: every device starts at BAUD, then the master steps it up
+// through baudRates (see device1.c) while every slave answers its probe right
 #define BAUD		9600
+#define BAUD_RATES			7
+#define BAUD_U2X			0x8000 // From baudSetting() -> double speed (U2X0), UBRR0 in the low bits
+#define BAUD_COMMIT			0x80 // Rate change byte: keep the rate on trial (its index in the low bits)
+#define BAUD_TRIAL_MS		250 // Rate on trial the master has not kept by then -> back to the last one kept
+#define BAUD_TRIAL_FRAMES	((uint16_t)((uint32_t)BAUD_TRIAL_MS * SCAN_RATE_HZ / 1000)) // Counted in full scan frames
+#define BAUD_PROBE_SIZE		48 // Bytes of a probe after the slave address (fits the master's transmit buffer)
+#define BAUD_ACK			0x06 // Answers to a probe
+#define BAUD_NAK			0x15
+#define PROBE_BYTE(i)		((uint8_t)((i) * 0x3B) ^ ((i) & 1 ? 0x55 : 0xAA)) // Byte i of a probe
+// Slave addressing (9-bit multi-processor mode): the master selects slaves with an
+// address byte (9th bit set), data bytes for other slaves never reach the CPU
+#ifndef SLAVE_ADDRESS
+#define SLAVE_ADDRESS		1 // 1 -> left half of the matrix, 2 -> right half (build with -DSLAVE_ADDRESS=2)
+#endif
+#define LINK_BROADCAST		0x00 // Address of every slave
+#define LINK_SYNC			0xFF // Address of the frame sync: every slave takes the one byte after it
+#define LINK_STREAM_END		0xFE // Address that ends a stream: every slave holds the frame it shows
+#define LINK_BAUD			0xFD // Address of a rate change: every slave takes the one byte after it
+#define LINK_PROBE			0xFC // Address of a rate probe: the slave address, then BAUD_PROBE_SIZE bytes
+#define LINK_POLL			0xFB // Address of a poll: the slave address, answered once what came before is parsed
+#define LINK_RESUME			0xFA // Address after a sync: the slaves selected before it carry on
+#define LINK_TRACE			0xF9 // Address of a profile request: the slave address, then it prints its profile
+#define LINK_ADDRESS_BIT	0x100 // 9th bit of a queued byte
+// UART receive queue: USART_RX_vect only queues bytes, the main loop parses them
+#define RX_BUFFER_SIZE		32 // Must be a power of 2
+// Frame sync from the master, once per frame boundary of its Timer1
+#define SYNC_RESTART		0x80 // Sync byte: start the received pattern from its first frame
+#define SYNC_TICK_MASK		0x7F // Sync byte: frame count of the master (for drift reports)
+#define SYNC_TIMEOUT_FRAMES	3 // Frames with no sync before running on this slave's clock alone
+#define SYNC_FORCE_TICKS	2 // Timer1 ticks from TCNT1 = OCR1A - 1 to the compare match clearing it
+#define SYNC_REPORT			0 // 1 -> drift measurement: print the ticks off at each sync on TX (USB serial,
+							// at the link's rate, with the wire to the master's RX off)
+#define ISR_PROFILE			0 // 1 -> time every interrupt handler, printed on TX at LINK_TRACE (as SYNC_REPORT)
+#define TX_REPORTS			(SYNC_REPORT || ISR_PROFILE) // TX is USB serial, no answers to the master
+// Wire format (binary, 1, 2 or 4 bits per LED)
+#define LINK_VERSION		5
+#define LINK_HEADER_SIZE	5
+#define LINK_WIDTH			1 // Header fields
+#define LINK_HEIGHT			2
+#define LINK_FRAMES			3
+#define LINK_DEPTH			4
+#define LINK_ENCODED		0x80 // In the depth field -> frames are encoded
+#define LINK_TIMED			0x40 // In the depth field -> each frame starts with its duration code
+#define LINK_STREAM			0x20 // In the depth field -> stream: frames keep coming into a ring of as many
+							// frames as the frames field (a power of 2) while it plays
+#define LINK_DEPTH_MASK		0x0F
+#define LINK_MAX_FRAME_BYTES	255 // Delta pairs index frame bytes with one byte
+// Units: each header, frame and generator packet comes after its own address byte,
+// as its sequence number, its bytes, then a CRC-8 of both (_crc8_ccitt_update from 0)
+#define LINK_SEQ_HEADER		0xFF // Sequence number of a header or generator packet (a frame's is its timestep,
+							// or its place in a stream modulo 256)
+#define LINK_POLL_DONE		(LINK_ADDRESS_BIT | BAUD_ACK) // Answer to a poll: pattern complete (otherwise the
+							// sequence number of a unit still missing, 9th bit clear)
+#define UNIT_SEQUENCE		0 // Unit being received: sequence number next
+#define UNIT_DONE			0xFF // Unit being received: CRC checked or unit dropped, the rest is ignored
+// Frame encodings: first byte of each frame, low bits count the byte pairs after it
+#define FRAME_KEY			0x00 // Packed frame as it is
+#define FRAME_DELTA			0x40 // (byte index, XOR mask) pairs against the previous frame
+#define FRAME_RLE			0x80 // (run length, byte) pairs
+#define FRAME_PAIRS_MASK	0x3F
+// Generator packet: pattern drawn by the slaves from a few parameters
+#define LINK_GENERATOR		(0x80 | LINK_VERSION) // First byte, instead of LINK_VERSION
+#define GEN_OPCODE			1 // Packet fields
+#define GEN_WIDTH			2
+#define GEN_HEIGHT			3
+#define GEN_ARG1			4
+#define GEN_ARG2			5
+#define GEN_ARG3			6
+#define GEN_LEVEL			7 // Intensity of lit LEDs (0 to 15)
+#define GEN_TIME			8 // Duration code of each step
+#define GEN_PACKET_SIZE		9
+#define GEN_NONE			0 // Opcodes
+#define GEN_SHIFT			1 // Column bar moving sideways
+#define GEN_SCROLL			2 // Row bar moving up or down
+#define GEN_ROTATE			3 // Column mask rotating with wrap
+#define GEN_CHASE			4 // Dots running round the border
+#define GEN_SWEEP			5 // Diagonal or arrow shaped band moving right
 // Register names
 #define ROW_PORT	PORTC
 #define COL_PORT	PORTD
@@ -38,50 +148,112 @@ void uart_putbyte(unsigned char data);
 #define COL1		7
 #define COL2		6
 #define COL3		5
+#define ROW_MASK	((1 << ROW1) | (1 << ROW2) | (1 << ROW3))
+#define COL_MASK	((1 << COL1) | (1 << COL2) | (1 << COL3))
 
 // LED matrix specs
+// Position of this device's tile in the whole matrix, used by the generators
+// (frames arrive already cut to the tile, see slaveTiles in device1.c)
 #define rowOffset	0
-#define colOffset	0
-
-// Initialise matrix
-const int rowPins[] = {ROW1, ROW2, ROW3};
-const int colPins[] = {COL1, COL2, COL3};
-const int rowSpan = sizeof(rowPins)/sizeof(rowPins[0]);
-const int colSpan = sizeof(colPins)/sizeof(colPins[0]);
-#define MAX_MTRX_POINTS		rowSpan*colSpan
+#define colOffset	((SLAVE_ADDRESS - 1) * colSpan) // Slaves side by side
+
+// Initialise matrix (port bit of each row/column)
+const uint8_t rowBits[] = {1 << ROW1, 1 << ROW2, 1 << ROW3};
+const uint8_t colBits[] = {1 << COL1, 1 << COL2, 1 << COL3};
+#define rowSpan						(sizeof(rowBits)/sizeof(rowBits[0]))
+#define colSpan						(sizeof(colBits)/sizeof(colBits[0]))
 #define MAX_MTRX_PATTERN_STEPS		20
 
-// Matrix points to flash, each 2 dimensional
-// Num of points in matrix = rows * length
-volatile int mtrxPoints[MAX_MTRX_PATTERN_STEPS][MAX_MTRX_POINTS][2] = {-1};
-volatile int numPoints[MAX_MTRX_PATTERN_STEPS] = {0};
+// Row scan
+#define SCAN_RATE_HZ				500 // Full frames per second (180 to 1300)
+#define SCAN_PRESCALER				64
+#define BAM_BITS					5 // Bits of intensity per LED (4 to 6 at 500 Hz, check with host/bench_bam.c)
+#define BAM_MAX						((1 << BAM_BITS) - 1)
+#define BAM_UNIT					(F_CPU / SCAN_PRESCALER / (SCAN_RATE_HZ * rowSpan * BAM_MAX)) // Timer ticks of the shortest slice
+#define BAM_MIN_TICKS				2 // Shortest on time the compare B interrupt can still end
+#define FADE_STEP_FRAMES			4 // Full frames per step of the opacity sweep
+#define FRAME_PRESCALER				1024 // Timer1, CTC with one frame per compare match (64 us ticks, up to 4.19 s)
+#define FRAME_TIME_FINE				100 // Duration codes 1 to 100: 10 ms steps (10 ms to 1 s)
+#define FRAME_TIME_FINE_MS			10
+#define FRAME_TIME_COARSE_MS		20 // Codes 101 to 255: 1 s plus 20 ms steps (up to 4.1 s)
+#define FRAME_TIME_DEFAULT			100 // 1 s, for frames sent without a duration
+#define FRAME_TICKS_8MS				(F_CPU / FRAME_PRESCALER * 8 / 1000) // Timer1 ticks in 8 ms, exactly (125):
+									// frameTicks() shifts instead of dividing in the frame interrupt
+
+// Interrupt profiling (ISR_PROFILE): Timer2 runs free as the clock, with its
+// overflows counted for 16 bit timestamps (131 ms round)
+#define PROFILE_PRESCALER			32 // 2 us ticks
+#define PROFILE_TRACE_SIZE			32 // Handler runs kept, must be a power of 2
+#define PROFILE_USART_RX			0 // Handlers timed
+#define PROFILE_SCAN				1
+#define PROFILE_SCAN_OFF			2
+#define PROFILE_FRAME				3
+#define PROFILE_HANDLERS			4
+// First line of a handler: times it up to whichever return it leaves by
+// (prologue and epilogue not counted), and is nothing at all when off
+#if ISR_PROFILE
+#define PROFILE_ISR(handler)		uint32_t profileMark __attribute__((cleanup(profileExit))) = profileStart(handler)
+#else
+#define PROFILE_ISR(handler)
+#endif
+
+// Brightness
+// Gamma tables are filled in by the compiler (GCC folds __builtin_pow on
+// constants), so the firmware only ever reads bytes from flash
+#define LEVEL_MAX					15 // Wire intensity levels 0 to 15
+#define GAMMA						2.2 // Perceived -> LED brightness exponent (1.0 = linear)
+#define GAMMA_ROUND(i, in, out)		((uint8_t)(__builtin_pow((double)(i) / (in), GAMMA) * (out) + 0.5))
+#define GAMMA_SCALE(i, in, out)		((i) && GAMMA_ROUND((i), in, out) == 0 ? 1 : GAMMA_ROUND((i), in, out)) // Only 0 is off
+#define GAMMA_4(i, in, out)			GAMMA_SCALE((i), in, out), GAMMA_SCALE((i) + 1, in, out), \
+									GAMMA_SCALE((i) + 2, in, out), GAMMA_SCALE((i) + 3, in, out)
+#define GAMMA_16(i, in, out)		GAMMA_4((i), in, out), GAMMA_4((i) + 4, in, out), \
+									GAMMA_4((i) + 8, in, out), GAMMA_4((i) + 12, in, out)
+#define GAMMA_64(i, in, out)		GAMMA_16((i), in, out), GAMMA_16((i) + 16, in, out), \
+									GAMMA_16((i) + 32, in, out), GAMMA_16((i) + 48, in, out)
+
+// BAM intensity (0 to BAM_MAX) of each wire level
+const uint8_t levelGamma[LEVEL_MAX + 1] PROGMEM = {
+	GAMMA_16(0, LEVEL_MAX, BAM_MAX)
+};
+// Opacity (0 to 255) of each step of the fade sweep
+const uint8_t opacityGamma[256] PROGMEM = {
+	GAMMA_64(0, 255, 255), GAMMA_64(64, 255, 255),
+	GAMMA_64(128, 255, 255), GAMMA_64(192, 255, 255)
+};
+
+// Frame buffers: COL_PORT bits to light on each row, per timestep and
+// intensity bit (bit planes for the BAM scan)
+// The front pattern (mtrxRows) keeps playing while the next one is
+// received into the back (mtrxRowsNext), then they swap on a frame boundary
+volatile uint8_t mtrxBuffers[2][MAX_MTRX_PATTERN_STEPS][BAM_BITS][rowSpan];
+volatile uint8_t (*volatile mtrxRows)[BAM_BITS][rowSpan] = mtrxBuffers[0];
+volatile uint8_t (*volatile mtrxRowsNext)[BAM_BITS][rowSpan] = mtrxBuffers[1];
+// Duration code of each timestep, swapped along with the frame buffers
+volatile uint8_t frameTimes[2][MAX_MTRX_PATTERN_STEPS];
+volatile uint8_t* volatile mtrxTimes = frameTimes[0];
+volatile uint8_t* volatile mtrxTimesNext = frameTimes[1];
 
 // Matrix settings
 volatile int opacityMode = 0; // Default
 volatile int patternTime = 0;
+// Full frames scanned, for pacing the opacity sweep
+volatile uint8_t scanFrames = 0;
+// Share of each BAM slice the rows stay on (0 to 255, gamma corrected)
+volatile uint8_t opacity = 255;
+// Link rate: index in baudRates of the one every device has kept, and of the
+// one the master is probing (on trial for baudTrialFrames more full frames)
+volatile uint8_t baudRate = 0;
+volatile uint8_t baudTrial = 0;
+volatile uint16_t baudTrialFrames = 0;
 
 /* --------------- LED Matrix --------------- */
-void blinkLED(int rowPin, int colPin)
-{
-	// Row on
-	CLEAR_BIT(ROW_PORT, rowPin);
-	// Column on
-	SET_BIT(COL_PORT, colPin);
-	
-	_delay_ms(5);
-
-	// Reset to clear
-	SET_BIT(ROW_PORT, rowPin);
-	CLEAR_BIT(COL_PORT, colPin);
-}
-
-void OCRAUpdate()
+void opacityUpdate()
 {
-	// OCR0A change counter and direction
+	// Opacity change counter and direction
 	static uint8_t count = 20;
 	static uint8_t up = 1;
 	
-	OCR0A = count; // Set compare value
+	opacity = pgm_read_byte(&opacityGamma[count]); // Set compare value (scaled per slice by the scan)
 	
 	// Incrementing compare value
 	if (up)
@@ -111,92 +283,1035 @@ void OCRAUpdate()
 	}
 }
 
-void turnOnLEDs()
+// Row scan with bit angle modulation
+// Each row is lit for BAM_BITS slices of 1, 2, 4, 8... BAM_UNIT ticks,
+// slice n showing bit n of every LED's intensity in one COL_PORT write
+ISR(TIMER0_COMPA_vect)
 {
-	// Display each point in matrix
-	for (int index = 0; index <= numPoints[patternTime]; index++)
+	PROFILE_ISR(PROFILE_SCAN);
+	static uint8_t scanRow = 0;
+	static uint8_t scanBit = 0;
+	
+	// Previous row off before the columns change (no ghosting)
+	clearLEDs();
+	
+	// Next slice, onto next row after the most significant bit
+	scanBit++;
+	if (scanBit == BAM_BITS)
 	{
-		// Blink LED at row, column
-		blinkLED(mtrxPoints[patternTime][index][0], mtrxPoints[patternTime][index][1]);
+		scanBit = 0;
+		scanRow++;
+		if (scanRow == rowSpan)
+		{
+			scanRow = 0;
+			scanFrames++;
+			
+			// Rate on trial and not kept in time -> back to the last one kept
+			if (baudTrialFrames && --baudTrialFrames == 0) setBaud(baudRate);
+		}
 	}
+	
+	// Slice length doubles with each bit
+	uint8_t ticks = BAM_UNIT << scanBit;
+	OCR0A = ticks - 1;
+	
+	// Opacity: row off again after its share of the slice
+	uint8_t onTicks = ((uint16_t)ticks * opacity) >> 8;
+	if (onTicks < BAM_MIN_TICKS) return; // Too short to time -> slice stays off
+	OCR0B = onTicks < ticks - 1 ? onTicks : 0xFF; // 0xFF never matches -> whole slice on
+	
+	// Columns lit on this row for this bit of the current timestep
+	COL_PORT = (COL_PORT & ~COL_MASK) | mtrxRows[patternTime][scanBit][scanRow];
+	// Row on
+	CLEAR_BITS(ROW_PORT, rowBits[scanRow]);
 }
 
-// PWM For setting opacity
-ISR (TIMER0_COMPA_vect)
+// PWM For setting opacity: row off after OCR0B of the slice
+ISR(TIMER0_COMPB_vect)
 {
+	PROFILE_ISR(PROFILE_SCAN_OFF);
 	clearLEDs();
-  	TCNT0 = 0;
 }
 
 void clearLEDs()
 {
 	// LED row
-	uint8_t mask = (1 << ROW1) | (1 << ROW2) | (1 << ROW3);
-	SET_BITS(ROW_PORT, mask);
+	SET_BITS(ROW_PORT, ROW_MASK);
 }
 
 /* --------------- Receiver --------------- */
-// Store the max timesteps of this pattern
+// Store the max timesteps of the shown and the received pattern
 volatile int maxTimestep = 0;
+volatile int nextMaxTimestep = 0;
+// Received pattern complete, waiting for the next frame boundary
+volatile uint8_t swapPending = 0;
+// Shown and received pattern is a stream: its frame moves on with the master's
+// sync only, to the frame the master is at once that has come in
+volatile uint8_t streaming = 0;
+volatile uint8_t nextStreaming = 0;
+// Stream being received: buffer holding its ring (-1 -> none), frames received
+// and the frame the master is at (both counted modulo 128, as in the sync)
+static int8_t streamBuffer = -1;
+static uint8_t streamFrames = 0;
+static uint8_t streamWanted = 0;
+
+// Received bytes waiting to be parsed (written by USART_RX_vect, read by the
+// main loop), 9 bits per character
+volatile uint16_t rxQueue[RX_BUFFER_SIZE];
+volatile uint8_t rxHead = 0; // Next free slot (written by USART_RX_vect)
+volatile uint8_t rxTail = 0; // Next byte to parse (written by main loop)
+volatile uint8_t rxOverruns = 0; // Characters lost: receiver overrun (DOR0) or queue full
+volatile uint8_t rxFrameErrors = 0; // Characters with a bad stop bit (FE0): wrong rate or noise
+// Rate probe for this slave: bytes of it so far (its slave address first),
+// those that came in as sent, and the characters lost before it
+static uint8_t probeIndex = 0;
+static uint8_t probeGood = 0;
+static uint8_t probeLost = 0;
+
+// Header of the pattern being received
+static uint8_t linkHeader[LINK_HEADER_SIZE];
+// Multiplier from the pattern's bits per LED up to a wire level
+static uint8_t levelScale = 0;
+// Packed bytes per frame
+static uint16_t frameBytes = 0;
+// Values (depth bits) of the LEDs this device shows, as of the last byte
+// received -> kept from frame to frame for XOR deltas, the frame they are
+// (LINK_SEQ_HEADER -> all off, before the first), and as they were before
+// the frame being received, for when it is dropped
+static uint8_t frameLevels[rowSpan][colSpan];
+static uint8_t levelsSequence = LINK_SEQ_HEADER;
+static uint8_t levelsKept[rowSpan][colSpan];
+// Pattern being received: header in and frames still due (patternOpen), or
+// every frame in, until the next header (patternDone), and the frames in so
+// far (bit per timestep, uploads only)
+static uint8_t patternOpen = 0;
+static uint8_t patternDone = 0;
+static uint32_t framesTaken = 0;
+// Unit being received: UNIT_SEQUENCE, 1 + its bytes so far (frames stay at 1)
+// or UNIT_DONE, its sequence number, CRC so far and whether the CRC byte is
+// next. A header or generator packet is held whole until it checks out
+static uint8_t unitState = UNIT_DONE;
+static uint8_t unitSequence = 0;
+static uint8_t unitCrc = 0;
+static uint8_t unitEnd = 0;
+static uint8_t unitBytes[GEN_PACKET_SIZE];
+// Frame being received: encoding, byte pairs left, packed byte position,
+// first byte of a pair (-1 -> none yet) and duration code (-1 -> not in yet)
+static uint8_t frameType = 0;
+static uint8_t pairs = 0;
+static uint16_t frameIndex = 0;
+static int16_t pairFirst = -1;
+static int16_t frameCode = -1;
+// Generator: pattern drawn here one step per frame instead of being sent as frames
+// (GEN_NONE in GEN_OPCODE -> stored pattern shown)
+static uint8_t genPacket[GEN_PACKET_SIZE];
+static uint8_t genStep = 0;
+// Next step drawn into the back buffer by the main loop, for the frame clock
+// to swap in (0 -> not drawn yet, the step shown stays a frame longer)
+volatile uint8_t genDrawn = 0;
 
 // 'USART Received' interrupt
+// Kept short so the receiver never overruns: addressing, link control and the
+// frame sync (timed from here) are handled now, pattern bytes are queued for
+// uartProcess()
 ISR(USART_RX_vect)
 {
-	char ch = UDR0; // Receive byte
+	PROFILE_ISR(PROFILE_USART_RX);
+	
+	// Link control the next byte is for (0 -> none): frame sync or rate change
+	// (one byte, can come between any two bytes of a pattern), or rate probe
+	static uint8_t control = 0;
+	// Data bytes are for this slave (last address other than link control)
+	static uint8_t selected = 0;
 	
-	processUARTByte(ch);
+	// Status and 9th bit have to be read before UDR0
+	uint8_t status = UCSR0A;
+	uint8_t address = BIT_IS_SET(UCSR0B, RXB80);
+	uint8_t ch = UDR0; // Receive byte
+	
+	if (BIT_IS_SET(status, DOR0)) rxOverruns++;
+	if (BIT_IS_SET(status, FE0)) rxFrameErrors++;
+	
+	if (address)
+	{
+		// Answer to a probe or poll is out: the master waits for it before
+		// sending on, and the other slaves share the wire
+		if (!TX_REPORTS) CLEAR_BIT(UCSR0B, TXEN0);
+		
+		// Listen to the data bytes that follow only if they are for this slave,
+		// otherwise the receiver drops them without raising this interrupt
+		// (after a sync, LINK_RESUME carries on with the slaves selected before)
+		control = ch == LINK_SYNC || ch == LINK_BAUD || ch == LINK_PROBE || ch == LINK_POLL ||
+			(ISR_PROFILE && ch == LINK_TRACE) ? ch : 0;
+		if (!control && ch != LINK_RESUME) selected = ch == SLAVE_ADDRESS || ch == LINK_BROADCAST;
+		if (selected || control) CLEAR_BIT(UCSR0A, MPCM0);
+		else SET_BIT(UCSR0A, MPCM0);
+		probeIndex = 0;
+		// A unit for this slave starts, or a stream ends: parsed in order with
+		// the bytes before it
+		if (control || ch == LINK_RESUME || (!selected && ch != LINK_STREAM_END)) return;
+	}
+	else if (control)
+	{
+		// Probes run to their last byte for the slave they name
+		if (control == LINK_PROBE && probeByte(ch)) return;
+		
+		// Stay as selected before, so data that follows is not dropped while
+		// the link control is handled
+		uint8_t command = control;
+		control = 0;
+		if (!selected) SET_BIT(UCSR0A, MPCM0);
+		if (command == LINK_SYNC) syncFrame(ch);
+		else if (command == LINK_BAUD) baudChange(ch);
+		
+		// Poll or profile request for this slave: answered once what came
+		// before it is parsed
+		if ((command != LINK_POLL && command != LINK_TRACE) || ch != SLAVE_ADDRESS) return;
+		address = 1;
+		ch = command;
+	}
+	else if (!selected)
+	{
+		// Let through before the address byte ahead of it was read
+		return;
+	}
+	
+	uint8_t next = (rxHead + 1) & (RX_BUFFER_SIZE - 1);
+	if (next == rxTail)
+	{
+		// Queue full -> byte lost
+		rxOverruns++;
+		return;
+	}
+	rxQueue[rxHead] = (address ? LINK_ADDRESS_BIT : 0) | ch;
+	rxHead = next;
 }
 
-// Process each character received
-void processUARTByte(char byte)
+// Parse the bytes queued by USART_RX_vect (looped)
+void uartProcess()
 {
-	// Matrix point counters
-	static int row = 0;
-	static int col = 0;
-	static int mtrxPointIndex = 0;
-	static int timestep = 0;
+	while (rxTail != rxHead)
+	{
+		uint16_t data = rxQueue[rxTail];
+		rxTail = (rxTail + 1) & (RX_BUFFER_SIZE - 1);
+		
+		if (data & LINK_ADDRESS_BIT)
+		{
+			uint8_t address = data;
+			if (address == LINK_POLL)
+			{
+				pollAnswer();
+			}
+			else if (ISR_PROFILE && address == LINK_TRACE)
+			{
+				profileDump();
+			}
+			else if (address == LINK_STREAM_END)
+			{
+				// Stream ended -> wait for the next header
+				streamBuffer = -1;
+				patternOpen = 0;
+				unitState = UNIT_DONE;
+			}
+			else
+			{
+				unitStart();
+			}
+		}
+		else
+		{
+			processUARTByte(data);
+		}
+	}
+}
+
+// Apply one packed byte of a frame (set, or XOR for a delta) to the LEDs
+// it covers
+void unpackByte(uint8_t index, uint8_t byte, uint8_t delta)
+{
+	uint8_t depth = linkHeader[LINK_DEPTH] & LINK_DEPTH_MASK;
+	uint8_t width = linkHeader[LINK_WIDTH];
+	// First LED in this byte
+	uint16_t led = (uint16_t)index * (8 / depth);
+	uint16_t row = led / width;
+	uint8_t col = led - row * width;
 	
-	switch (byte)
+	// Depth bits per LED, row by row, most significant bit first
+	for (uint8_t shift = 8; shift != 0 && row < linkHeader[LINK_HEIGHT]; )
 	{
-		case 0: // Last point of this timestep
-			// Reset counts
-			row = 0;
+		shift -= depth;
+		uint8_t value = (byte >> shift) & ((1 << depth) - 1);
+		
+		// Frames only carry this device's tile (the master cuts them out),
+		// anything past the row/column span of its matrix is ignored
+		if (col < colSpan && row < rowSpan)
+		{
+			if (delta)
+			{
+				frameLevels[row][col] ^= value;
+			}
+			else
+			{
+				frameLevels[row][col] = value;
+			}
+		}
+		
+		// Next LED, wrapping onto next row
+		col++;
+		if (col == width)
+		{
+			row++;
 			col = 0;
-			mtrxPointIndex = 0;
-			// Next timestep
-			timestep++;
+		}
+	}
+}
+
+// Buffer frames are received into: the back buffer, or a stream's ring
+// (which stays where it is once the stream is shown)
+uint8_t rxBuffer()
+{
+	if (streamBuffer >= 0) return streamBuffer;
+	return mtrxRowsNext == mtrxBuffers[0] ? 0 : 1;
+}
+
+// Bit planes of a received timestep from the LED values
+void storeFrame(int timestep)
+{
+	volatile uint8_t (*rows)[BAM_BITS][rowSpan] = mtrxBuffers[rxBuffer()];
+	
+	for (uint8_t row = 0; row < rowSpan; row++)
+	{
+		uint8_t planes[BAM_BITS] = {0};
+		
+		for (uint8_t col = 0; col < colSpan; col++)
+		{
+			uint8_t level = pgm_read_byte(&levelGamma[frameLevels[row][col] * levelScale]);
+			
+			// Column on in the port mask of each set intensity bit
+			for (uint8_t bit = 0; bit < BAM_BITS; bit++)
+			{
+				if (level & (1 << bit)) planes[bit] |= colBits[col];
+			}
+		}
+		
+		for (uint8_t bit = 0; bit < BAM_BITS; bit++)
+		{
+			rows[timestep][bit][row] = planes[bit];
+		}
+	}
+}
+
+// Address byte ahead of a unit for this slave: a frame cut short is dropped
+void unitStart()
+{
+	if (unitState != UNIT_SEQUENCE && unitState != UNIT_DONE && unitSequence != LINK_SEQ_HEADER)
+	{
+		memcpy(frameLevels, levelsKept, sizeof(frameLevels));
+	}
+	unitState = UNIT_SEQUENCE;
+}
+
+// Process each byte received
+// A unit only takes effect once its CRC checks out. One that does not, or is
+// cut short, is dropped and the master sends it again when it polls
+void processUARTByte(uint8_t byte)
+{
+	if (unitState == UNIT_DONE) return;
+	
+	if (unitState == UNIT_SEQUENCE)
+	{
+		// Sequence number: header or generator packet, or the frame it is
+		unitSequence = byte;
+		unitCrc = _crc8_ccitt_update(0, byte);
+		unitEnd = 0;
+		unitState = 1;
+		if (byte == LINK_SEQ_HEADER)
+		{
+			// Next pattern on its way
+			patternOpen = 0;
+			patternDone = 0;
+		}
+		else if (!patternOpen)
+		{
+			// Frame with no header in for it -> dropped, pattern not complete
+			patternDone = 0;
+			unitState = UNIT_DONE;
+		}
+		else
+		{
+			// Frame: LEDs as they are kept, in case it is dropped
+			memcpy(levelsKept, frameLevels, sizeof(levelsKept));
+			frameIndex = frameBytes;
+			pairs = 0;
+			frameCode = -1;
+		}
+		return;
+	}
+	
+	if (unitEnd)
+	{
+		// CRC byte: keep the unit, or drop it
+		uint8_t taken = 0;
+		if (byte == unitCrc) taken = unitSequence == LINK_SEQ_HEADER ? headerTaken() : frameTaken();
+		if (!taken && unitSequence != LINK_SEQ_HEADER) memcpy(frameLevels, levelsKept, sizeof(frameLevels));
+		unitState = UNIT_DONE;
+		return;
+	}
+	unitCrc = _crc8_ccitt_update(unitCrc, byte);
+	
+	if (unitSequence == LINK_SEQ_HEADER)
+	{
+		// Header or generator packet, in a format version we understand
+		if (unitState == 1 && byte != LINK_VERSION && byte != LINK_GENERATOR)
+		{
+			unitState = UNIT_DONE;
 			return;
-		case 4: // End of transmission
-			// Save last timestep number
-			maxTimestep = timestep;
+		}
+		unitBytes[unitState++ - 1] = byte;
+		unitEnd = unitState - 1 == (unitBytes[0] == LINK_GENERATOR ? GEN_PACKET_SIZE : LINK_HEADER_SIZE);
+		return;
+	}
+	
+	if (frameCode < 0)
+	{
+		// Start of a frame, its duration code first if the pattern is timed
+		frameCode = FRAME_TIME_DEFAULT;
+		if (linkHeader[LINK_DEPTH] & LINK_TIMED)
+		{
+			frameCode = byte;
 			return;
-		case '1': // LED point - on
-			// Check if within bounds of this device's handling of LED matrix
-			// based on row/column offset/span of matrix
-			
-			if (col >= colOffset && col <= colOffset + colSpan &&
-				row >= rowOffset && row <= rowOffset + rowSpan)
+		}
+	}
+	
+	if (frameIndex == frameBytes && pairs == 0)
+	{
+		// Packed bytes unless the pattern is encoded
+		frameType = FRAME_KEY;
+		frameIndex = 0;
+		pairFirst = -1;
+		
+		if (linkHeader[LINK_DEPTH] & LINK_ENCODED)
+		{
+			// Encoding and number of byte pairs
+			frameType = byte & ~FRAME_PAIRS_MASK;
+			pairs = byte & FRAME_PAIRS_MASK;
+			// Delta with no changes -> frame repeats, nothing follows
+			if (frameType != FRAME_DELTA || pairs != 0) return;
+		}
+	}
+	
+	if (frameType == FRAME_KEY)
+	{
+		unpackByte(frameIndex++, byte, 0);
+	}
+	else if (pairs == 0)
+	{
+		// Empty delta
+	}
+	else if (pairFirst < 0)
+	{
+		// Run length or byte index, value follows
+		pairFirst = byte;
+		return;
+	}
+	else if (frameType == FRAME_DELTA)
+	{
+		unpackByte(pairFirst, byte, 1);
+		pairFirst = -1;
+		pairs--;
+	}
+	else
+	{
+		// Run of equal bytes
+		for (uint8_t run = pairFirst; run != 0 && frameIndex < frameBytes; run--)
+		{
+			unpackByte(frameIndex++, byte, 0);
+		}
+		pairFirst = -1;
+		pairs--;
+	}
+	
+	// Frame complete once all its bytes or pairs are in, its CRC next
+	if (frameType == FRAME_DELTA ? pairs != 0 : frameIndex != frameBytes) return;
+	unitEnd = 1;
+}
+
+// Header or generator packet that checks out
+// Returns 0 if it is rejected
+uint8_t headerTaken()
+{
+	if (unitBytes[0] == LINK_GENERATOR)
+	{
+		// Pattern drawn here from now on, nothing more to come
+		startGenerator(unitBytes);
+		patternDone = 1;
+		return 1;
+	}
+	
+	// Reject patterns that do not fit, wait for the next header
+	uint8_t depth = unitBytes[LINK_DEPTH] & LINK_DEPTH_MASK;
+	uint16_t bytes = ((uint16_t)unitBytes[LINK_WIDTH] * unitBytes[LINK_HEIGHT] * depth + 7) / 8;
+	uint8_t frames = unitBytes[LINK_FRAMES];
+	uint8_t stream = unitBytes[LINK_DEPTH] & LINK_STREAM;
+	if (frames > MAX_MTRX_PATTERN_STEPS || bytes == 0 ||
+		(depth != 1 && depth != 2 && depth != 4) || bytes > LINK_MAX_FRAME_BYTES ||
+		(stream && (frames == 0 || (frames & (frames - 1)) != 0)))
+	{
+		return 0;
+	}
+	memcpy(linkHeader, unitBytes, LINK_HEADER_SIZE);
+	frameBytes = bytes;
+	
+	// Back buffer is overwritten -> drop a pattern not shown yet,
+	// and stop a generator drawing into it (interrupts off: the
+	// frame clock swaps buffers)
+	cli();
+	swapPending = 0;
+	genPacket[GEN_OPCODE] = GEN_NONE;
+	genDrawn = 0;
+	// A stream's ring is the back buffer until it is shown
+	streamBuffer = -1;
+	if (stream) streamBuffer = rxBuffer();
+	nextStreaming = stream != 0;
+	streamFrames = 0;
+	sei();
+	
+	// Full scale of each depth (1, 3 or 15) becomes LEVEL_MAX
+	levelScale = LEVEL_MAX / ((1 << depth) - 1);
+	
+	// Deltas start from all LEDs off, no frames in yet
+	memset(frameLevels, 0, sizeof(frameLevels));
+	levelsSequence = LINK_SEQ_HEADER;
+	framesTaken = 0;
+	patternOpen = 1;
+	
+	// Pattern with no frames -> already complete
+	if (frames == 0)
+	{
+		nextMaxTimestep = 0;
+		swapPending = 1;
+		patternOpen = 0;
+		patternDone = 1;
+	}
+	return 1;
+}
+
+// Frame that checks out: kept if its sequence number is one the pattern
+// still has room for and, for a delta, the LEDs are at the frame before it
+// (otherwise it is missing, and the master sends it again as a keyframe)
+// Returns 0 if it is dropped
+uint8_t frameTaken()
+{
+	uint8_t frames = linkHeader[LINK_FRAMES];
+	uint8_t sequence = unitSequence;
+	
+	if (streamBuffer >= 0 ? ((sequence - streamFrames) & SYNC_TICK_MASK) >= frames : sequence >= frames) return 0;
+	if (frameType == FRAME_DELTA && (uint8_t)(sequence - 1) != levelsSequence) return 0;
+	levelsSequence = sequence;
+	
+	// Stream: its place in the ring
+	uint8_t timestep = streamBuffer >= 0 ? sequence & (frames - 1) : sequence;
+	frameTimes[rxBuffer()][timestep] = frameCode;
+	storeFrame(timestep);
+	
+	if (streamBuffer >= 0)
+	{
+		// Stream: ready once the ring is full the first time, frames lost on
+		// the way keep what their slot had (interrupts off: the master's sync
+		// moves the stream on too)
+		cli();
+		streamFrames = sequence + 1;
+		if ((uint8_t)(sequence + 1) >= frames && mtrxRowsNext == mtrxBuffers[streamBuffer] && !swapPending)
+		{
+			nextMaxTimestep = frames;
+			swapPending = 1;
+		}
+		// Frame the master is at may have been waiting for this one
+		streamSeek();
+		sei();
+	}
+	else
+	{
+		framesTaken |= 1UL << sequence;
+		if (framesTaken == (1UL << frames) - 1)
+		{
+			// Every frame in -> show it from the next frame boundary
+			nextMaxTimestep = frames;
+			swapPending = 1;
+			patternOpen = 0;
+			patternDone = 1;
+		}
+	}
+	return 1;
+}
+
+// Answer a poll on the wire the slaves share: LINK_POLL_DONE once the
+// pattern is complete (or a stream is coming in), otherwise the sequence
+// number of the first unit missing, for the master to send again
+// The transmitter goes off again at the next address byte
+void pollAnswer()
+{
+	uint16_t answer = LINK_POLL_DONE;
+	
+	// TX is on USB serial instead of the wire
+	if (TX_REPORTS) return;
+	
+	if (!patternDone && streamBuffer < 0)
+	{
+		answer = LINK_SEQ_HEADER;
+		for (uint8_t frame = 0; patternOpen && frame < linkHeader[LINK_FRAMES]; frame++)
+		{
+			if (!(framesTaken & (1UL << frame)))
 			{
-				// Found point
-				mtrxPoints[timestep][mtrxPointIndex][0] = rowPins[row-rowOffset];
-				mtrxPoints[timestep][mtrxPointIndex][1] = colPins[col-colOffset];
+				answer = frame;
+				break;
 			}
+		}
+	}
+	
+	SET_BIT(UCSR0B, TXEN0);
+	if (answer & LINK_ADDRESS_BIT) SET_BIT(UCSR0B, TXB80);
+	else CLEAR_BIT(UCSR0B, TXB80);
+	UDR0 = (uint8_t)answer;
+}
+
+/* --------------- Generators --------------- */
+// Steps before a generator's motion repeats
+uint8_t generatorPeriod()
+{
+	uint8_t width = genPacket[GEN_WIDTH];
+	uint8_t height = genPacket[GEN_HEIGHT];
+	
+	switch (genPacket[GEN_OPCODE])
+	{
+		case GEN_SCROLL:
+			return height + genPacket[GEN_ARG1];
+		case GEN_CHASE:
+			// Dots spread evenly round the border
+			return (2 * (width + height) - 4) / genPacket[GEN_ARG1];
+		default:
+			return width;
+	}
+}
+
+// Whether the LED at row/col of the whole matrix is lit at a step
+uint8_t generatorLit(uint8_t row, uint8_t col, uint8_t step)
+{
+	uint8_t width = genPacket[GEN_WIDTH];
+	uint8_t height = genPacket[GEN_HEIGHT];
+	uint8_t arg1 = genPacket[GEN_ARG1];
+	uint8_t arg2 = genPacket[GEN_ARG2];
+	
+	switch (genPacket[GEN_OPCODE])
+	{
+		case GEN_SHIFT:
+		{
+			// Bar of arg1 columns, arg2: 0 -> moving right, 1 -> left
+			if (arg2) col = width - 1 - col;
+			return (col + width - step) % width < arg1;
+		}
+		case GEN_SCROLL:
+		{
+			// Bar of arg1 rows, arg2: 0 -> moving down, 1 -> up
+			if (arg2) row = height - 1 - row;
+			return row <= step && step - row < arg1;
+		}
+		case GEN_ROTATE:
+		{
+			// Column mask arg1 (bit 7 -> column 0, every 8 columns) moving
+			// right with wrap, each row arg2 columns further on
+			uint8_t shift = (step + (uint16_t)arg2 * row) % width;
+			uint8_t c = (col + width - shift) % width;
+			return (arg1 >> (7 - (c & 7))) & 1;
+		}
+		case GEN_CHASE:
+		{
+			// arg1 dots with arg2 tail, down the left side, along the bottom,
+			// up the right side and back along the top
+			uint8_t perimeter = 2 * (width + height) - 4;
+			uint8_t k;
+			if (col == 0) k = row;
+			else if (row == height - 1) k = height - 1 + col;
+			else if (col == width - 1) k = height + width - 2 + (height - 1 - row);
+			else if (row == 0) k = 2 * height + width - 3 + (width - 1 - col);
+			else return 0; // Inside the border
 			
-			mtrxPointIndex++; // Ready for next point
-			col++;
-			break;
-		case '0': // LED point - off
-			col++;
-			break;
-		case ',': // End of row - onto next row
-			row++;
-			col = 0;
-			break;
-		default: // Unrecognised - ignore
-			break;
+			for (uint8_t dot = 0; dot < arg1; dot++)
+			{
+				uint8_t head = (step + (uint16_t)dot * perimeter / arg1) % perimeter;
+				if ((head + perimeter - k) % perimeter <= arg2) return 1;
+			}
+			return 0;
+		}
+		case GEN_SWEEP:
+		{
+			// Band of arg1 columns moving right, arg2 columns of slope per row
+			// (signed), arg3: 1 -> rows counted from the middle (arrow head)
+			int8_t slope = arg2;
+			int16_t rows = row;
+			if (genPacket[GEN_ARG3]) rows = rows > (height - 1) / 2 ? rows - (height - 1) / 2 : (height - 1) / 2 - rows;
+			int16_t c = ((int16_t)col - step - slope * rows) % width;
+			if (c < 0) c += width;
+			return c < arg1;
+		}
+		default:
+			return 0;
+	}
+}
+
+// Start a generator from a received packet, shown from the next frame boundary
+void startGenerator(uint8_t* packet)
+{
+	uint8_t opcode = packet[GEN_OPCODE];
+	uint8_t width = packet[GEN_WIDTH];
+	uint8_t height = packet[GEN_HEIGHT];
+	
+	// Ignore generators this device does not know or cannot draw
+	if (opcode == GEN_NONE || opcode > GEN_SWEEP || width == 0 || height == 0 ||
+		packet[GEN_LEVEL] > LEVEL_MAX ||
+		(opcode == GEN_CHASE && (width < 2 || height < 2 || packet[GEN_ARG1] == 0)))
+	{
+		return;
+	}
+	
+	// Interrupts off: the frame clock swaps in the generator running now
+	cli();
+	for (uint8_t i = 0; i < GEN_PACKET_SIZE; i++)
+	{
+		genPacket[i] = packet[i];
+	}
+	genStep = 0;
+	genDrawn = 0;
+	// Drop a received pattern not shown yet, and stop a stream
+	swapPending = 0;
+	streamBuffer = -1;
+	nextStreaming = 0;
+	sei();
+}
+
+// Draw the next step into the back buffer (main loop, while genDrawn is 0:
+// TIMER1_COMPA_vect leaves the back buffer alone until then)
+void renderGenerator()
+{
+	for (uint8_t row = 0; row < rowSpan; row++)
+	{
+		for (uint8_t col = 0; col < colSpan; col++)
+		{
+			frameLevels[row][col] = generatorLit(row + rowOffset, col + colOffset, genStep) ?
+				genPacket[GEN_LEVEL] : 0;
+		}
+	}
+	// Levels are already 0 to LEVEL_MAX
+	levelScale = 1;
+	storeFrame(0);
+	
+	mtrxTimesNext[0] = genPacket[GEN_TIME];
+	nextMaxTimestep = 1;
+	
+	genStep++;
+	if (genStep >= generatorPeriod()) genStep = 0;
+	genDrawn = 1;
+}
+
+/* --------------- Frame sync --------------- */
+// Frames since the last sync (SYNC_TIMEOUT_FRAMES -> no master sync, free running)
+volatile uint8_t syncMissed = SYNC_TIMEOUT_FRAMES;
+// Sync taken in by USART_RX_vect, the rest of it done by TIMER1_COMPA_vect
+// (forced if no compare match is waiting): the sync byte, the frame step
+// owed at its boundary, and ticks to add to Timer1 once the forced compare
+// has cleared it
+volatile uint8_t syncDue = 0;
+static uint8_t syncByte = 0;
+static uint8_t syncStep = 0;
+static uint8_t syncPhase = 0;
+// Drift measurement: ticks this slave's frame clock was off at the last
+// sync (> 0 -> ahead of the master) and the master's frame count then
+volatile int16_t syncDrift = 0;
+volatile uint8_t syncTick = 0;
+volatile uint8_t syncReportDue = 0;
+// Timer1 ticks from the master's frame boundary to its sync coming in:
+// address and sync byte on the wire at the link's rate (set by setBaud())
+static uint8_t syncLatency = 0;
+
+// Timer1 ticks of a frame duration code (0 -> shortest)
+uint16_t frameTicks(uint8_t code)
+{
+	uint16_t ms = code <= FRAME_TIME_FINE ? code * FRAME_TIME_FINE_MS :
+		FRAME_TIME_FINE * FRAME_TIME_FINE_MS + (code - FRAME_TIME_FINE) * FRAME_TIME_COARSE_MS;
+	if (ms == 0) ms = FRAME_TIME_FINE_MS;
+	return (uint32_t)ms * FRAME_TICKS_8MS / 8;
+}
+
+// Compare match at the end of the timestep now shown
+void loadFrameTime()
+{
+	uint8_t code = maxTimestep ? mtrxTimes[patternTime] : FRAME_TIME_DEFAULT;
+	OCR1A = frameTicks(code) - 1;
+}
+
+// Master's frame boundary was syncLatency ticks ago: measure how far off
+// this slave's Timer1 is, and have TIMER1_COMPA_vect put it where the
+// master's is (called from USART_RX_vect, so the frame step is left to it)
+void syncFrame(uint8_t sync)
+{
+	uint16_t count = TCNT1;
+	uint8_t stepDue = BIT_IS_SET(TIFR1, OCF1A); // Compare match waiting behind this interrupt
+	
+	syncTick = sync & SYNC_TICK_MASK;
+	syncReportDue = 1;
+	syncMissed = 0;
+	syncByte = sync;
+	syncDue = 1;
+	
+	if (stepDue)
+	{
+		// Its frame step is next anyway
+		syncDrift = (int16_t)(count - syncLatency);
+		syncStep = 1;
+		syncPhase = 0;
+		TCNT1 = syncLatency;
+		return;
+	}
+	
+	// Behind, in the second half of its frame: the frame step is owed now
+	// (ahead: no step, the sync is taken in all the same)
+	syncStep = count > OCR1A / 2;
+	syncDrift = (int16_t)(syncStep ? count - OCR1A - 1 - syncLatency : count - syncLatency);
+	syncPhase = syncLatency + SYNC_FORCE_TICKS;
+	TCNT1 = OCR1A - 1;
+}
+
+// Show the received pattern (back buffer) from its start
+void swapPattern()
+{
+	volatile uint8_t (*shown)[BAM_BITS][rowSpan] = mtrxRows;
+	mtrxRows = mtrxRowsNext;
+	mtrxRowsNext = shown;
+	volatile uint8_t* times = mtrxTimes;
+	mtrxTimes = mtrxTimesNext;
+	mtrxTimesNext = times;
+	maxTimestep = nextMaxTimestep;
+	streaming = nextStreaming;
+	patternTime = 0;
+	swapPending = 0;
+}
+
+// Sync restart: every slave swaps in its part of a new upload, or goes back
+// to the first frame, at the same boundary
+void restartPattern()
+{
+	if (swapPending) swapPattern();
+	patternTime = 0;
+	loadFrameTime();
+}
+
+// Shown stream: on to the frame the master is at (streamWanted) if it has
+// come in, otherwise the last one stays until it does
+void streamSeek()
+{
+	uint8_t ahead = (streamFrames - streamWanted) & SYNC_TICK_MASK;
+	
+	if (!streaming || streamBuffer < 0 || mtrxRows != mtrxBuffers[streamBuffer]) return;
+	if (ahead == 0 || ahead > maxTimestep) return;
+	patternTime = streamWanted % maxTimestep;
+}
+
+// Drift measurement line on TX: "<slave> <master frame> <ticks off>"
+void reportDrift()
+{
+	char line[20]; // Longest: a 3 digit address and tick, a 6 character drift
+	reportLine(line, sprintf(line, "%u %u %d\r\n", SLAVE_ADDRESS, syncTick, syncDrift));
+}
+
+// Line of text on TX (USB serial, TX_REPORTS)
+// 9th bit set -> reads as an extra stop bit on an 8N1 terminal
+void reportLine(const char* line, uint8_t length)
+{
+	SET_BIT(UCSR0B, TXB80);
+	for (uint8_t i = 0; i < length; i++)
+	{
+		while (!BIT_IS_SET(UCSR0A, UDRE0));
+		UDR0 = line[i];
+	}
+}
+
+/* --------------- Interrupt profiling --------------- */
+// Per handler: runs, and fewest, most and total Timer2 ticks they took
+volatile uint32_t profileRuns[PROFILE_HANDLERS];
+volatile uint16_t profileLeast[PROFILE_HANDLERS];
+volatile uint16_t profileMost[PROFILE_HANDLERS];
+volatile uint32_t profileTotal[PROFILE_HANDLERS];
+// Trace ring: the last PROFILE_TRACE_SIZE runs of any handler, in order,
+// the next one written at profileHead
+volatile uint8_t profileTraceHandler[PROFILE_TRACE_SIZE];
+volatile uint16_t profileTraceStart[PROFILE_TRACE_SIZE];
+volatile uint16_t profileTraceTicks[PROFILE_TRACE_SIZE];
+volatile uint8_t profileHead = 0;
+volatile uint8_t profileTraced = 0; // Runs in the ring (up to PROFILE_TRACE_SIZE)
+volatile uint8_t profileWraps = 0; // Timer2 overflows
+volatile uint8_t profilePaused = 0; // Being printed -> handlers not recorded
+const char* const profileNames[PROFILE_HANDLERS] = {"RX", "SCAN", "OFF", "FRAME"};
+
+// Timer2 ticks, with its overflows in the high byte
+// Interrupts are off in a handler: an overflow not counted yet is still
+// pending, seen as a count that has only just wrapped
+uint16_t profileNow()
+{
+	uint8_t count = TCNT2;
+	uint8_t wraps = profileWraps;
+	
+	if (BIT_IS_SET(TIFR2, TOV2) && count < 0x80) wraps++;
+	return ((uint16_t)wraps << 8) | count;
+}
+
+// Handler starting: its number in the high bits, the time in the low bits
+uint32_t profileStart(uint8_t handler)
+{
+	return ((uint32_t)handler << 16) | profileNow();
+}
+
+// Handler leaving (cleanup of PROFILE_ISR's mark): into its figures and the
+// trace ring
+void profileExit(uint32_t* mark)
+{
+	uint8_t handler = *mark >> 16;
+	uint16_t start = *mark;
+	uint16_t ticks = profileNow() - start;
+	
+	if (profilePaused) return;
+	if (profileRuns[handler] == 0 || ticks < profileLeast[handler]) profileLeast[handler] = ticks;
+	if (ticks > profileMost[handler]) profileMost[handler] = ticks;
+	profileRuns[handler]++;
+	profileTotal[handler] += ticks;
+	
+	profileTraceHandler[profileHead] = handler;
+	profileTraceStart[profileHead] = start;
+	profileTraceTicks[profileHead] = ticks;
+	profileHead = (profileHead + 1) & (PROFILE_TRACE_SIZE - 1);
+	if (profileTraced < PROFILE_TRACE_SIZE) profileTraced++;
+}
+
+#if ISR_PROFILE
+ISR(TIMER2_OVF_vect)
+{
+	profileWraps++;
+}
+#endif
+
+// Profile on TX, then start it over: a line per handler "<name> <runs>
+// <least> <most> <mean>" in CPU cycles, then the trace ring oldest first,
+// "<name> <start> <cycles>" with the start in Timer2 ticks
+// Handlers are not recorded meanwhile (the lines take a while at low rates)
+void profileDump()
+{
+	char line[56]; // Longest: a handler line with four 10 digit figures
+	
+	profilePaused = 1;
+	reportLine(line, sprintf(line, "ISR %u: runs least most mean\r\n", SLAVE_ADDRESS));
+	for (uint8_t handler = 0; handler < PROFILE_HANDLERS; handler++)
+	{
+		uint32_t runs = profileRuns[handler];
+		reportLine(line, sprintf(line, "%s %lu %lu %lu %lu\r\n", profileNames[handler], (unsigned long)runs,
+			(unsigned long)profileLeast[handler] * PROFILE_PRESCALER,
+			(unsigned long)profileMost[handler] * PROFILE_PRESCALER,
+			runs ? (unsigned long)(profileTotal[handler] * PROFILE_PRESCALER / runs) : 0UL));
+	}
+	for (uint8_t i = 0; i < profileTraced; i++)
+	{
+		uint8_t entry = (profileHead - profileTraced + i) & (PROFILE_TRACE_SIZE - 1);
+		reportLine(line, sprintf(line, "%s %u %lu\r\n", profileNames[profileTraceHandler[entry]],
+			profileTraceStart[entry], (unsigned long)profileTraceTicks[entry] * PROFILE_PRESCALER));
+	}
+	
+	memset((void*)profileRuns, 0, sizeof(profileRuns));
+	memset((void*)profileMost, 0, sizeof(profileMost));
+	memset((void*)profileTotal, 0, sizeof(profileTotal));
+	profileTraced = 0;
+	profilePaused = 0;
+}
+
+/* --------------- Link rate --------------- */
+// Link rates, slowest first (as in device1.c, with the error of each)
+const uint32_t baudRates[BAUD_RATES] PROGMEM = {
+	BAUD, 19200, 38400, 57600, 76800, 115200, 250000
+};
+
+// UBRR0 for a baud rate, with BAUD_U2X for double speed where that comes
+// closer to it (normal speed takes more samples per bit, so it wins a tie)
+uint16_t baudSetting(uint32_t baud)
+{
+	uint16_t normal = (F_CPU + 8 * baud) / (16 * baud) - 1;
+	uint16_t fast = (F_CPU + 4 * baud) / (8 * baud) - 1;
+	int32_t normalOff = F_CPU / (16UL * (normal + 1)) - baud;
+	int32_t fastOff = F_CPU / (8UL * (fast + 1)) - baud;
+	if (normalOff < 0) normalOff = -normalOff;
+	if (fastOff < 0) fastOff = -fastOff;
+	
+	if (fastOff < normalOff) return BAUD_U2X | fast;
+	return normal;
+}
+
+// Receive (and answer) at one of baudRates
+void setBaud(uint8_t rate)
+{
+	uint16_t setting = baudSetting(pgm_read_dword(&baudRates[rate]));
+	uint8_t divider = setting & BAUD_U2X ? 8 : 16;
+	
+	UBRR0 = setting & ~BAUD_U2X;
+	if (setting & BAUD_U2X) SET_BIT(UCSR0A, U2X0);
+	else CLEAR_BIT(UCSR0A, U2X0);
+	
+	// Address and sync byte, 11 bits each
+	syncLatency = 2UL * 11 * divider * (UBRR0 + 1) / FRAME_PRESCALER;
+}
+
+// Rate change from the master (LINK_BAUD): try a rate until it is kept,
+// or keep the one on trial (BAUD_COMMIT)
+void baudChange(uint8_t change)
+{
+	uint8_t rate = change & ~BAUD_COMMIT;
+	if (rate >= BAUD_RATES) return;
+	
+	if (change & BAUD_COMMIT)
+	{
+		if (baudTrialFrames && rate == baudTrial)
+		{
+			baudRate = rate;
+			baudTrialFrames = 0;
+		}
+		return;
 	}
 	
-	numPoints[timestep] = mtrxPointIndex; // Update num of points
+	// Byte is in: the master waits for it before switching as well
+	baudTrial = rate;
+	baudTrialFrames = BAUD_TRIAL_FRAMES;
+	setBaud(rate);
+}
+
+// Next byte of a rate probe (LINK_PROBE): the slave it names checks each
+// byte against PROBE_BYTE, then answers on TX once the last is in
+// Returns 0 once the probe is over for this slave
+uint8_t probeByte(uint8_t byte)
+{
+	if (probeIndex == 0)
+	{
+		// Another slave's probe
+		if (byte != SLAVE_ADDRESS) return 0;
+		probeGood = 0;
+		probeLost = rxOverruns + rxFrameErrors;
+	}
+	else if (byte == PROBE_BYTE(probeIndex - 1))
+	{
+		probeGood++;
+	}
+	if (probeIndex++ < BAUD_PROBE_SIZE) return 1;
+	
+	// Transmitter on for the answer only, it is off again at the next address
+	uint8_t lost = rxOverruns + rxFrameErrors - probeLost;
+	SET_BIT(UCSR0B, TXEN0);
+	CLEAR_BIT(UCSR0B, TXB80);
+	UDR0 = probeGood == BAUD_PROBE_SIZE && lost == 0 ? BAUD_ACK : BAUD_NAK;
+	return 0;
 }
 
 /* --------------- Initialise --------------- */
@@ -205,54 +1320,136 @@ void setupLEDs()
 	// Initialise registers
 	
 	// LED row
-	uint8_t mask = (1 << ROW1) | (1 << ROW2) | (1 << ROW3);
-	SET_BITS(ROW_DDR, mask);
+	SET_BITS(ROW_DDR, ROW_MASK);
 	// Turn all LEDs off (all rows off)
-	SET_BITS(ROW_PORT, mask);
+	SET_BITS(ROW_PORT, ROW_MASK);
 	
 	// LED col
-	mask = (1 << COL1) | (1 << COL2) | (1 << COL3);
-	SET_BITS(COL_DDR, mask);
+	SET_BITS(COL_DDR, COL_MASK);
 }
 
 void setupTimers()
 {
-	// Timers for opacity PWM
-	SET_BIT(TCCR0B, CS02);
-	// Waveform - Fast PWM
-	SET_BIT(TCCR0A, WGM00);
+	// Timer for row scan and opacity PWM
+	// Waveform - CTC, TOP = OCR0A (one BAM slice)
 	SET_BIT(TCCR0A, WGM01);
-	// Compare interrupt enable
+	// Prescaler 64 (SCAN_PRESCALER)
+	SET_BIT(TCCR0B, CS00);
+	SET_BIT(TCCR0B, CS01);
+	// Compare A (next slice) and compare B (row off) interrupt enable
 	SET_BIT(TIMSK0, OCIE0A);
+	SET_BIT(TIMSK0, OCIE0B);
 	
-	OCR0A = 255; // Default
+	OCR0A = BAM_UNIT - 1;
+	OCR0B = 0xFF; // Default
 	
 	// Pause/play timer
+	// Waveform - CTC, TOP = OCR1A (duration of the frame shown)
+	SET_BIT(TCCR1B, WGM12);
+	// Prescaler 1024 (FRAME_PRESCALER)
+	SET_BIT(TCCR1B, CS10);
 	SET_BIT(TCCR1B, CS12);
-	SET_BIT(TIMSK1, TOIE1);
+	SET_BIT(TIMSK1, OCIE1A);
+	
+	OCR1A = frameTicks(FRAME_TIME_DEFAULT) - 1;
+	
+	// Interrupt profiling clock (ISR_PROFILE)
+	// Waveform - normal, free running, overflow interrupt counts its rounds
+	if (ISR_PROFILE)
+	{
+		// Prescaler 32 (PROFILE_PRESCALER)
+		SET_BIT(TCCR2B, CS20);
+		SET_BIT(TCCR2B, CS21);
+		SET_BIT(TIMSK2, TOIE2);
+	}
 }
-ISR(TIMER1_OVF_vect)
+
+// Frame boundary: next generator step, received pattern or timestep, and
+// how long it is shown for
+void frameStep()
 {
-	patternTime++;
-	if (patternTime == maxTimestep)
+	if (syncMissed < SYNC_TIMEOUT_FRAMES) syncMissed++;
+	
+	if (genPacket[GEN_OPCODE] != GEN_NONE)
 	{
-		patternTime = 0;
+		// Generator running -> the next step the main loop drew becomes a one
+		// frame pattern (drawn here, it would hold off the receiver for ~2000
+		// cycles, over two characters' time above 76800 baud)
+		if (genDrawn)
+		{
+			swapPattern();
+			genDrawn = 0;
+		}
+	}
+	else if (swapPending && syncMissed >= SYNC_TIMEOUT_FRAMES)
+	{
+		// Frame boundary -> swap in a fully received pattern, from its start
+		// (with the master's sync running, its restart swaps every slave at once)
+		swapPattern();
+	}
+	else if (streaming)
+	{
+		// Stream -> moved on by the master's sync
 	}
+	else
+	{
+		patternTime++;
+		// Reset pattern time if exceeds the max (set from processUARTByte)
+		if (patternTime >= maxTimestep)
+		{
+			patternTime = 0;
+		}
+	}
+	
+	loadFrameTime();
+}
+ISR(TIMER1_COMPA_vect)
+{
+	PROFILE_ISR(PROFILE_FRAME);
+	
+	if (!syncDue)
+	{
+		frameStep();
+		return;
+	}
+	
+	// Master's sync: Timer1 to its frame clock, then the frame step of this
+	// boundary if one is owed
+	syncDue = 0;
+	TCNT1 += syncPhase;
+	if (syncStep)
+	{
+		frameStep();
+		syncMissed = 0; // Not a missed sync
+	}
+	
+	// Restart after the frame step of this boundary
+	if (syncByte & SYNC_RESTART) restartPattern();
+	
+	// Stream: the sync carries the frame the master is at
+	streamWanted = syncByte & SYNC_TICK_MASK;
+	streamSeek();
+	loadFrameTime();
 }
 
 void setupUART()
 {
-    UBRR0 = F_CPU / 16 / BAUD - 1;
-	
-    UCSR0A = 0;
+    // Multi-processor mode: only address bytes are received until one selects this slave
+    UCSR0A = (1 << MPCM0);
+    baudRate = 0;
+    baudTrialFrames = 0;
+    setBaud(baudRate);
 	
 	// Enable interrupts
-	uint8_t mask = (1 << RXEN0) | (1 << TXEN0) | (1 << RXCIE0);
+	// The slaves' TX pins share one wire to the master's RX: transmitter on
+	// only to answer a probe or poll (or for TX_REPORTS, without that wire)
+	uint8_t mask = (1 << RXEN0) | (1 << RXCIE0) | (TX_REPORTS ? (1 << TXEN0) : 0);
     SET_BITS(UCSR0B, mask);
 	
-	// Character size
-	mask = (1 << UCSZ00) | (1 << UCSZ01) | (1 << UCSZ02);
+	// Character size: 9 bits, the 9th marks address bytes
+	mask = (1 << UCSZ00) | (1 << UCSZ01);
     SET_BITS(UCSR0C, mask);
+    SET_BIT(UCSR0B, UCSZ02);
 }
 
 /* ------ Main ------ */
@@ -261,12 +1458,45 @@ int main() {
 	setupTimers();
 	setupUART();
 	
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	
 	sei();
 	
 	while (1) {
-		// Quickly flash matrix of LEDs to simulate matrix LED display
-		turnOnLEDs();
-		OCRAUpdate();
+		// Matrix of LEDs is refreshed by the row scan interrupts,
+		// step the opacity sweep every few full frames
+		if (scanFrames >= FADE_STEP_FRAMES)
+		{
+			scanFrames = 0;
+			opacityUpdate();
+		}
+		
+		if (SYNC_REPORT && syncReportDue)
+		{
+			syncReportDue = 0;
+			reportDrift();
+		}
+		
+		// Patterns received
+		uartProcess();
+		
+		// Generator running -> its next step, for the frame clock to swap in
+		if (genPacket[GEN_OPCODE] != GEN_NONE && !genDrawn)
+		{
+			renderGenerator();
+		}
+		
+		// Idle until next interrupt, unless a byte came in since the queue was
+		// emptied or a generator step is still to be drawn
+		cli();
+		if (rxTail == rxHead && (genPacket[GEN_OPCODE] == GEN_NONE || genDrawn))
+		{
+			sleep_enable();
+			sei();
+			sleep_cpu();
+			sleep_disable();
+		}
+		sei();
 	}
 }
 
@@ -0,0 +1,23 @@
+# Memory footprint of one firmware image, from `avr-size -A <elf>`
+# Variables: elf (name), flash and ram (device sizes in bytes)
+# .text is flash only, .data is stored in flash and copied to RAM at reset,
+# .bss and .noinit are RAM only. RAM left over is shared by the stack.
+
+$1 == ".text" || $1 == ".data" || $1 == ".bss" || $1 == ".noinit" || $1 == ".eeprom" {
+	size[$1] = $2
+}
+
+END {
+	printf "%s\n", elf
+	printf "  %-8s %6s  %s\n", "Section", "Bytes", "Memory"
+	printf "  %-8s %6d  %s\n", ".text", size[".text"], "flash"
+	printf "  %-8s %6d  %s\n", ".data", size[".data"], "flash + RAM"
+	printf "  %-8s %6d  %s\n", ".bss", size[".bss"], "RAM"
+	printf "  %-8s %6d  %s\n", ".noinit", size[".noinit"], "RAM"
+	printf "  %-8s %6d  %s\n", ".eeprom", size[".eeprom"], "EEPROM"
+
+	used = size[".text"] + size[".data"]
+	printf "  Flash %6d of %6d bytes (%5.1f%%), %6d free\n", used, flash, 100 * used / flash, flash - used
+	used = size[".data"] + size[".bss"] + size[".noinit"]
+	printf "  RAM   %6d of %6d bytes (%5.1f%%), %6d left for the stack\n\n", used, ram, 100 * used / ram, ram - used
+}
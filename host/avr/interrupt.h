@@ -0,0 +1,20 @@
+// Host stand-in for <avr/interrupt.h>
+// ISR(vector) defines a plain function that sim_avr.c picks up by name and
+// calls whenever the matching interrupt is enabled and pending.
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+#include "../sim_avr.h"
+
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+#ifdef __cplusplus
+#define ISR(vector, ...)	extern "C" void vector(void); void vector(void)
+#else
+#define ISR(vector, ...)	void vector(void); void vector(void)
+#endif
+
+#define sei()				simSei()
+#define cli()				simCli()
+
+#endif
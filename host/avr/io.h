@@ -0,0 +1,166 @@
+// Host stand-in for <avr/io.h> (ATmega328P subset)
+// Registers are plain globals owned by sim_avr.c, so the firmware sources
+// compile unmodified with gcc and run against the simulated peripherals.
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#include <stdint.h>
+
+// Digital I/O
+// PORTx and DDRx are reached through simPinAccess(), which traces the pins
+// the access before it changed, so writes inside one handler keep their
+// order in the VCD trace (sim_avr.c)
+extern volatile uint8_t PINB, simDDRB, simPORTB;
+extern volatile uint8_t PINC, simDDRC, simPORTC;
+extern volatile uint8_t PIND, simDDRD, simPORTD;
+volatile uint8_t* simPinAccess(volatile uint8_t* reg);
+#define DDRB	(*simPinAccess(&simDDRB))
+#define PORTB	(*simPinAccess(&simPORTB))
+#define DDRC	(*simPinAccess(&simDDRC))
+#define PORTC	(*simPinAccess(&simPORTC))
+#define DDRD	(*simPinAccess(&simDDRD))
+#define PORTD	(*simPinAccess(&simPORTD))
+
+// Status register / sleep
+extern volatile uint8_t SREG, SMCR, MCUCR;
+
+// Timer/Counter0
+extern volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B, TIMSK0, TIFR0;
+// Timer/Counter1
+extern volatile uint8_t TCCR1A, TCCR1B, TCCR1C, TIMSK1, TIFR1;
+extern volatile uint16_t TCNT1, OCR1A, OCR1B, ICR1;
+// Timer/Counter2
+extern volatile uint8_t TCCR2A, TCCR2B, TCNT2, OCR2A, OCR2B, TIMSK2, TIFR2;
+
+// USART0
+// UDR0 is 16 bits wide on the host: the simulator tags the bytes it places
+// there with SIM_UDR_OWNED, so a firmware write (always < 0x100) can be told
+// apart from a byte still waiting to be read.
+extern volatile uint8_t UCSR0A, UCSR0B, UCSR0C;
+extern volatile uint16_t UBRR0, UDR0;
+#define SIM_UDR_OWNED	0x8000
+
+// ADC
+extern volatile uint8_t ADMUX, ADCSRA, ADCSRB, DIDR0;
+extern volatile uint16_t ADC;
+#define ADCW	ADC
+
+/* --------------- Bit positions --------------- */
+// SREG
+#define SREG_I		7
+// SMCR
+#define SE			0
+#define SM0			1
+#define SM1			2
+#define SM2			3
+
+// TCCR0A / TCCR0B
+#define WGM00		0
+#define WGM01		1
+#define COM0B0		4
+#define COM0B1		5
+#define COM0A0		6
+#define COM0A1		7
+#define CS00		0
+#define CS01		1
+#define CS02		2
+#define WGM02		3
+#define FOC0B		6
+#define FOC0A		7
+// TIMSK0 / TIFR0
+#define TOIE0		0
+#define OCIE0A		1
+#define OCIE0B		2
+#define TOV0		0
+#define OCF0A		1
+#define OCF0B		2
+
+// TCCR1A / TCCR1B
+#define WGM10		0
+#define WGM11		1
+#define COM1B0		4
+#define COM1B1		5
+#define COM1A0		6
+#define COM1A1		7
+#define CS10		0
+#define CS11		1
+#define CS12		2
+#define WGM12		3
+#define WGM13		4
+#define ICES1		6
+#define ICNC1		7
+// TIMSK1 / TIFR1
+#define TOIE1		0
+#define OCIE1A		1
+#define OCIE1B		2
+#define ICIE1		5
+#define TOV1		0
+#define OCF1A		1
+#define OCF1B		2
+#define ICF1		5
+
+// TCCR2A / TCCR2B
+#define WGM20		0
+#define WGM21		1
+#define COM2B0		4
+#define COM2B1		5
+#define COM2A0		6
+#define COM2A1		7
+#define CS20		0
+#define CS21		1
+#define CS22		2
+#define WGM22		3
+// TIMSK2 / TIFR2
+#define TOIE2		0
+#define OCIE2A		1
+#define OCIE2B		2
+#define TOV2		0
+#define OCF2A		1
+#define OCF2B		2
+
+// UCSR0A
+#define MPCM0		0
+#define U2X0		1
+#define UPE0		2
+#define DOR0		3
+#define FE0			4
+#define UDRE0		5
+#define TXC0		6
+#define RXC0		7
+// UCSR0B
+#define TXB80		0
+#define RXB80		1
+#define UCSZ02		2
+#define TXEN0		3
+#define RXEN0		4
+#define UDRIE0		5
+#define TXCIE0		6
+#define RXCIE0		7
+// UCSR0C
+#define UCPOL0		0
+#define UCSZ00		1
+#define UCSZ01		2
+#define USBS0		3
+#define UPM00		4
+#define UPM01		5
+#define UMSEL00		6
+#define UMSEL01		7
+
+// ADMUX / ADCSRA
+#define MUX0		0
+#define MUX1		1
+#define MUX2		2
+#define MUX3		3
+#define ADLAR		5
+#define REFS0		6
+#define REFS1		7
+#define ADPS0		0
+#define ADPS1		1
+#define ADPS2		2
+#define ADIE		3
+#define ADIF		4
+#define ADATE		5
+#define ADSC		6
+#define ADEN		7
+
+#endif
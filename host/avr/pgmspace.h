@@ -0,0 +1,17 @@
+// Host stand-in for <avr/pgmspace.h>
+// Flash and RAM share one address space on the host, so program memory
+// reads are plain loads.
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+
+#include <stdint.h>
+
+#define PROGMEM
+#define PSTR(s)					(s)
+
+#define pgm_read_byte(addr)		(*(const uint8_t*)(addr))
+#define pgm_read_word(addr)		(*(const uint16_t*)(addr))
+#define pgm_read_dword(addr)	(*(const uint32_t*)(addr))
+#define pgm_read_ptr(addr)		(*(const void* const*)(addr))
+
+#endif
@@ -0,0 +1,21 @@
+// Host stand-in for <avr/sleep.h>
+// Sleeping skips simulated time ahead to the next interrupt.
+#ifndef HOST_AVR_SLEEP_H
+#define HOST_AVR_SLEEP_H
+
+#include "io.h"
+#include "../sim_avr.h"
+
+#define SLEEP_MODE_IDLE			(0 << SM0)
+#define SLEEP_MODE_ADC			(1 << SM0)
+#define SLEEP_MODE_PWR_DOWN		(2 << SM0)
+#define SLEEP_MODE_PWR_SAVE		(3 << SM0)
+#define SLEEP_MODE_STANDBY		(6 << SM0)
+
+#define set_sleep_mode(mode)	(SMCR = (SMCR & ~((1 << SM0) | (1 << SM1) | (1 << SM2))) | (mode))
+#define sleep_enable()			(SMCR |= (1 << SE))
+#define sleep_disable()			(SMCR &= ~(1 << SE))
+#define sleep_cpu()				simSleep()
+#define sleep_mode()			do { sleep_enable(); sleep_cpu(); sleep_disable(); } while (0)
+
+#endif
@@ -0,0 +1,97 @@
+// Link baud rates of the master (device1.c): UBRR0 error of each rate in
+// baudRates, and the rate baudNegotiate() settles on when the slaves' wire
+// only works up to some rate
+// The slaves are modelled: they answer a probe with BAUD_ACK at any rate up
+// to their limit and not at all above it (garbled), and keep a rate once it
+// is committed, as device2.c does.
+//
+// Build: gcc -O2 -fgnu89-inline -Ihost -o baud_report host/baud_report.c host/sim_avr.c
+#include <stdio.h>
+
+#define main device1_main
+#include "../device1.c"
+#undef main
+
+#define RECEIVER_TOLERANCE	1.5 // Recommended most error of a receiver with 9 data bits, in % (datasheet)
+
+// Modelled slaves: rate they are at, rate they have kept, and how far they
+// are into a link control sequence
+static uint32_t slaveLimit = 0;
+static uint8_t slaveRate = 0;
+static uint8_t slaveKept = 0;
+static uint16_t slaveControl = 0;
+static uint8_t slaveIndex = 0;
+
+static void slaveByte(uint16_t data)
+{
+	if (data & LINK_ADDRESS_BIT)
+	{
+		slaveControl = data & 0xFF;
+		slaveIndex = 0;
+		return;
+	}
+	if (slaveControl == LINK_BAUD)
+	{
+		if (data & BAUD_COMMIT) slaveKept = data & ~BAUD_COMMIT;
+		else slaveRate = data;
+		slaveControl = 0;
+	}
+	else if (slaveControl == LINK_PROBE && ++slaveIndex == 1 + BAUD_PROBE_SIZE)
+	{
+		// Last byte: answer if it all came in at this rate
+		if (pgm_read_dword(&baudRates[slaveRate]) <= slaveLimit) simReceive(BAUD_ACK);
+	}
+}
+
+// Negotiate from BAUD against slaves that work up to limit
+static void negotiate(uint32_t limit)
+{
+	slaveLimit = limit;
+	slaveRate = 0;
+	slaveKept = 0;
+	baudRate = 0;
+	setBaud(baudRate);
+
+	uint64_t start = simCycle;
+	baudNegotiate();
+	// Slaves give up on a rate they were not told to keep
+	if (slaveRate != slaveKept) slaveRate = slaveKept;
+
+	printf("%-10lu %10lu %10lu %8.0f\n", (unsigned long)limit,
+		(unsigned long)pgm_read_dword(&baudRates[baudRate]),
+		(unsigned long)pgm_read_dword(&baudRates[slaveRate]), (simCycle - start) * 1e3 / F_CPU);
+}
+
+/* --------------- Main --------------- */
+int main()
+{
+	printf("UBRR0 error at %lu MHz, 9-bit characters (11 bits on the wire)\n", F_CPU / 1000000);
+	printf("%-10s %4s %6s %10s %8s %8s %10s  %s\n", "Baud", "U2X0", "UBRR0", "Actual", "Error", "Char us",
+		"Bytes/s", "Terminal");
+	for (uint8_t rate = 0; rate < BAUD_RATES; rate++)
+	{
+		uint32_t baud = pgm_read_dword(&baudRates[rate]);
+		uint16_t setting = baudSetting(baud);
+		uint16_t ubrr = setting & ~BAUD_U2X;
+		double actual = (double)F_CPU / ((setting & BAUD_U2X ? 8 : 16) * (ubrr + 1.0));
+		double error = (actual - baud) * 100.0 / baud;
+		printf("%-10lu %4u %6u %10.0f %+7.2f%% %8.1f %10.0f  %s\n", (unsigned long)baud,
+			(setting & BAUD_U2X) != 0, ubrr, actual, error, 11e6 / actual, actual / 11,
+			error <= RECEIVER_TOLERANCE && error >= -RECEIVER_TOLERANCE ? "yes" : "no");
+	}
+	printf("(Terminal: within +-%.1f%% of a device at the exact rate; between these boards the error cancels)\n\n",
+		RECEIVER_TOLERANCE);
+
+	simSetTxHandler(slaveByte);
+	uartSetup();
+	sei();
+	printf("Negotiation from %u baud\n", BAUD);
+	printf("%-10s %10s %10s %8s\n", "Wire up to", "Master", "Slaves", "ms");
+	negotiate(BAUD);
+	negotiate(57600);
+	negotiate(115200);
+	negotiate(500000);
+	negotiate(1000000);
+
+	return 0;
+}
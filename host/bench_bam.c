@@ -0,0 +1,260 @@
+// Bit-angle modulation budget for the slave (device2.c)
+// Prints the CPU load of the BAM row scan for a range of scan rates, then
+// runs the real scan against the simulated timers and measures the on time
+// of every LED for a known grayscale pattern, and the on time per second of
+// a lit LED with 1 to 9 LEDs lit (the scan period is fixed, so it must not
+// depend on how many are on). Exits nonzero when either check fails.
+//
+// ISR costs are hand-counted from avr-gcc -O2 output (prologue, epilogue and
+// body); pass measured figures as arguments to override them:
+//   bench_bam [slice ISR cycles] [blank ISR cycles]
+//
+// Build: gcc -O2 -fgnu89-inline -Ihost -o bench_bam host/bench_bam.c host/sim_avr.c
+#include <stdio.h>
+
+#define main device2_main
+#include "../device2.c"
+#undef main
+
+#define SLICE_ISR_CYCLES	110 // TIMER0_COMPA_vect
+#define BLANK_ISR_CYCLES	35 // TIMER0_COMPB_vect
+#define RUN_MS				1000
+#define UNIFORM_FRAMES		100 // Whole scan frames measured, so every row gets the same share
+#define UNIFORM_LEVEL		LEVEL_MAX
+#define UNIFORM_TOLERANCE	0.5 // Most a lit LED's on time may differ from the mean, in %
+#define LEVEL_TOLERANCE		0.005 // Most a level's on time may miss its expected share, of full brightness
+
+static uint32_t sliceCycles = SLICE_ISR_CYCLES;
+static uint32_t blankCycles = BLANK_ISR_CYCLES;
+
+/* --------------- Budget --------------- */
+// One slice ISR and (when dimmed) one blank ISR per slice, BAM_BITS slices
+// per row. The shortest slice must outlast both ISRs or the scan falls behind.
+static void budget(uint32_t rateHz)
+{
+	uint32_t unit = F_CPU / SCAN_PRESCALER / (rateHz * rowSpan * BAM_MAX);
+	uint32_t shortest = unit * SCAN_PRESCALER;
+	uint32_t slices = rateHz * rowSpan * BAM_BITS;
+	double load = 100.0 * slices * (sliceCycles + blankCycles) / F_CPU;
+
+	printf("%8lu | %8lu %10lu %10lu | %7.1f%% | %s\n",
+		(unsigned long)rateHz, (unsigned long)unit, (unsigned long)shortest,
+		(unsigned long)slices, load,
+		unit == 0 || (unit << (BAM_BITS - 1)) > 0xFF ? "out of range"
+		: shortest > sliceCycles + blankCycles ? "fits" : "too short");
+}
+
+/* --------------- Measured --------------- */
+// Test pattern: a 6x3 frame whose top-left 3x3 window (the tile this slave
+// shows) covers 9 wire levels
+static const uint8_t levels[3][3] = {
+	{0, 1, 2},
+	{3, 5, 7},
+	{9, 12, 15},
+};
+
+static uint64_t onCycles[3][3];
+static uint64_t lastChange = 0;
+static uint8_t lastRows = 0xFF;
+static uint8_t lastCols = 0;
+
+// Integrate the time each LED spent lit (row low, column high)
+static void pinsChanged()
+{
+	uint64_t elapsed = simCycle - lastChange;
+	for (uint8_t row = 0; row < rowSpan; row++)
+	{
+		if (lastRows & rowBits[row]) continue;
+		for (uint8_t col = 0; col < colSpan; col++)
+		{
+			if (lastCols & colBits[col]) onCycles[row][col] += elapsed;
+		}
+	}
+	lastChange = simCycle;
+	lastRows = ROW_PORT;
+	lastCols = COL_PORT;
+}
+
+// One byte per character time, as the master's USART would deliver them
+// (9 bits, 0x100 marks an address byte)
+static void receive(uint16_t byte)
+{
+	simReceive(byte);
+	simAdvance(simUartCharCycles());
+}
+
+// One unit to every slave: address, sequence number, bytes, CRC-8
+static void sendUnit(uint8_t sequence, const uint8_t* bytes, uint8_t length)
+{
+	uint8_t crc = _crc8_ccitt_update(0, sequence);
+	receive(0x100 | LINK_BROADCAST);
+	receive(sequence);
+	for (uint8_t i = 0; i < length; i++)
+	{
+		receive(bytes[i]);
+		crc = _crc8_ccitt_update(crc, bytes[i]);
+	}
+	receive(crc);
+}
+
+// One frame of levels, shown from the next frame boundary
+static void sendPattern(const uint8_t (*frameLevels)[3])
+{
+	uint8_t header[LINK_HEADER_SIZE] = {LINK_VERSION, 6, 3, 1, 4};
+	uint8_t frame[9];
+	const volatile void* shown = mtrxRows;
+	sendUnit(LINK_SEQ_HEADER, header, LINK_HEADER_SIZE);
+
+	for (uint8_t row = 0; row < 3; row++)
+	{
+		// Left half carries the levels, right half stays dark
+		frame[3 * row] = (frameLevels[row][0] << 4) | frameLevels[row][1];
+		frame[3 * row + 1] = frameLevels[row][2] << 4;
+		frame[3 * row + 2] = 0;
+	}
+	sendUnit(0, frame, sizeof(frame));
+
+	// Wait for the pattern to reach the front buffer (parsed by the main loop)
+	while (mtrxRows == shown)
+	{
+		uartProcess();
+		simSleep();
+	}
+}
+
+static uint8_t measure()
+{
+	setupLEDs();
+	setupTimers();
+	setupUART();
+	simIsrCycles[SIM_TIMER0_COMPA] = sliceCycles;
+	simIsrCycles[SIM_TIMER0_COMPB] = blankCycles;
+	sei();
+
+	sendPattern(levels);
+
+	simSetPinHandler(pinsChanged);
+	lastChange = simCycle;
+	lastRows = ROW_PORT;
+	lastCols = COL_PORT;
+	uint64_t start = simCycle;
+	uint64_t startSleep = simSleepCycles;
+	uint32_t startSlices = simIsrCount[SIM_TIMER0_COMPA];
+	uint8_t startFrames = scanFrames;
+	uint32_t frames = 0;
+
+	while (simCycle - start < (uint64_t)F_CPU * RUN_MS / 1000)
+	{
+		simSleep();
+		frames += (uint8_t)(scanFrames - startFrames);
+		startFrames = scanFrames;
+	}
+	pinsChanged();
+
+	uint64_t elapsed = simCycle - start;
+	uint32_t slices = simIsrCount[SIM_TIMER0_COMPA] - startSlices;
+	printf("Scan %lu Hz: %.1f frames/s measured, %.1f slices/s, ISR load %.1f%%\n\n",
+		(unsigned long)SCAN_RATE_HZ, frames * (double)F_CPU / elapsed,
+		slices * (double)F_CPU / elapsed,
+		100.0 * (elapsed - (simSleepCycles - startSleep)) / elapsed);
+
+	// Full brightness is one row's share of the frame, each level should
+	// reach its gamma corrected share of that
+	double full = (double)onCycles[2][2] / elapsed;
+	uint8_t accurate = 1;
+	printf("%5s %5s | %8s %8s | %8s %8s\n", "Level", "BAM", "Duty", "Expected", "Relative", "Error");
+	for (uint8_t row = 0; row < rowSpan; row++)
+	{
+		for (uint8_t col = 0; col < colSpan; col++)
+		{
+			double duty = (double)onCycles[row][col] / elapsed;
+			double relative = full > 0 ? duty / full : 0;
+			uint8_t code = pgm_read_byte(&levelGamma[levels[row][col]]);
+			double expected = (double)code / BAM_MAX;
+			if (relative - expected > LEVEL_TOLERANCE || expected - relative > LEVEL_TOLERANCE) accurate = 0;
+			printf("%5u %5u | %7.2f%% %7.2f%% | %8.3f %+7.3f\n",
+				levels[row][col], code, 100.0 * duty, 100.0 * expected / rowSpan,
+				relative, relative - expected);
+		}
+	}
+	printf("(Error: within +-%.3f of full brightness) %s\n", LEVEL_TOLERANCE,
+		accurate ? "accurate" : "NOT ACCURATE");
+	return accurate;
+}
+
+/* --------------- Uniformity --------------- */
+// On time per second of every lit LED with the first n of the 9 lit, all at
+// UNIFORM_LEVEL: the mean, and the furthest any lit LED is from it
+static uint8_t uniformity()
+{
+	printf("\n%u LEDs lit at level %u, on ms per s of each lit LED\n", (unsigned)(rowSpan * colSpan), UNIFORM_LEVEL);
+	printf("%4s | %8s %8s %8s | %s\n", "Lit", "Mean", "Least", "Most", "Within");
+
+	double reference = 0;
+	uint8_t uniform = 1;
+	for (uint8_t lit = 1; lit <= rowSpan * colSpan; lit++)
+	{
+		uint8_t frameLevels[3][3] = {{0}};
+		for (uint8_t i = 0; i < lit; i++) frameLevels[i / 3][i % 3] = UNIFORM_LEVEL;
+		sendPattern(frameLevels);
+
+		// From one full frame boundary to another
+		uint8_t frames = scanFrames;
+		while (scanFrames == frames) simSleep();
+		memset(onCycles, 0, sizeof(onCycles));
+		pinsChanged();
+		uint64_t start = simCycle;
+		for (uint8_t counted = 0; counted < UNIFORM_FRAMES; counted++)
+		{
+			frames = scanFrames;
+			while (scanFrames == frames) simSleep();
+		}
+		pinsChanged();
+
+		double seconds = (double)(simCycle - start) / F_CPU;
+		double least = 1e9, most = 0, total = 0;
+		for (uint8_t i = 0; i < lit; i++)
+		{
+			double ms = onCycles[i / 3][i % 3] * 1e3 / F_CPU / seconds;
+			if (ms < least) least = ms;
+			if (ms > most) most = ms;
+			total += ms;
+		}
+		double mean = total / lit;
+		if (lit == 1) reference = mean;
+
+		// Against each other and against a single LED lit
+		double spread = 100.0 * (most - least) / mean;
+		double drift = 100.0 * (mean - reference) / reference;
+		uint8_t within = spread <= UNIFORM_TOLERANCE && drift <= UNIFORM_TOLERANCE && drift >= -UNIFORM_TOLERANCE;
+		if (!within) uniform = 0;
+		printf("%4u | %8.2f %8.2f %8.2f | %s\n", lit, mean, least, most, within ? "yes" : "no");
+	}
+	printf("(Within: +-%.1f%% of each other and of one LED lit alone) %s\n", UNIFORM_TOLERANCE,
+		uniform ? "uniform" : "NOT UNIFORM");
+	return uniform;
+}
+
+/* --------------- Main --------------- */
+int main(int argc, char** argv)
+{
+	if (argc > 1) sliceCycles = strtoul(argv[1], NULL, 0);
+	if (argc > 2) blankCycles = strtoul(argv[2], NULL, 0);
+
+	printf("BAM %u bits, gamma %.1f, %u rows, prescaler %u, ISR %lu + %lu cycles per slice\n\n",
+		BAM_BITS, GAMMA, (unsigned)rowSpan, SCAN_PRESCALER,
+		(unsigned long)sliceCycles, (unsigned long)blankCycles);
+	printf("%8s | %8s %10s %10s | %8s | %s\n",
+		"Scan Hz", "Unit", "Cycles", "Slices/s", "CPU", "Shortest slice");
+	const uint32_t rates[] = {180, 250, 500, 1000, 1300, 2000};
+	for (uint8_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
+	{
+		budget(rates[i]);
+	}
+	printf("\n");
+
+	// Both checks always run, so a failing one still prints the other
+	uint8_t accurate = measure();
+	uint8_t uniform = uniformity();
+	return accurate && uniform ? 0 : 1;
+}
@@ -0,0 +1,121 @@
+// Receive interrupt load of one slave (device2.c) on a shared, addressed bus
+// Feeds pattern uploads to the simulated USART as 9-bit characters and counts
+// the USART_RX_vect interrupts this slave takes, with the multi-processor
+// communication mode (MPCM) filtering data bytes meant for other slaves.
+//
+// ISR cost is estimated for avr-gcc -O2 code (prologue, epilogue and queueing
+// the byte; the main loop parses it, see bench_rx); pass a measured figure to
+// override:
+//   bench_mpcm [RX ISR cycles]
+//
+// Build: gcc -O2 -fgnu89-inline -Ihost -o bench_mpcm host/bench_mpcm.c host/sim_avr.c
+#include <stdio.h>
+
+#define main device2_main
+#include "../device2.c"
+#undef main
+
+#define RX_ISR_CYCLES		70 // USART_RX_vect
+#define ADDRESS_BYTE(a)		(0x100 | (a)) // 9th bit set
+#define NO_ADDRESS			-1
+#define UPLOAD_FRAMES		20
+#define UPLOAD_FRAME_BYTES	3 // 6x3 LEDs, 1 bit each
+#define MAX_SLAVES			8
+
+static uint32_t rxCycles = RX_ISR_CYCLES;
+static uint32_t bytesOnWire = 0;
+
+// One character per character time, as the master's USART would deliver them
+static void receive(uint16_t data)
+{
+	simReceive(data);
+	simAdvance(simUartCharCycles());
+	uartProcess();
+	bytesOnWire++;
+}
+
+// One unit: sequence number, bytes and CRC-8, after an address byte unless NO_ADDRESS
+static void unit(int address, uint8_t sequence, const uint8_t* bytes, uint8_t length)
+{
+	uint8_t crc = _crc8_ccitt_update(0, sequence);
+
+	if (address != NO_ADDRESS) receive(ADDRESS_BYTE(address));
+	receive(sequence);
+	for (uint8_t i = 0; i < length; i++)
+	{
+		receive(bytes[i]);
+		crc = _crc8_ccitt_update(crc, bytes[i]);
+	}
+	receive(crc);
+}
+
+// Header and frames of one pattern
+static void upload(int address)
+{
+	uint8_t header[LINK_HEADER_SIZE] = {LINK_VERSION, 6, 3, UPLOAD_FRAMES, 1};
+
+	unit(address, LINK_SEQ_HEADER, header, LINK_HEADER_SIZE);
+	for (uint8_t frame = 0; frame < UPLOAD_FRAMES; frame++)
+	{
+		uint8_t bytes[UPLOAD_FRAME_BYTES];
+		for (uint8_t i = 0; i < UPLOAD_FRAME_BYTES; i++) bytes[i] = frame + i;
+		unit(address, frame, bytes, UPLOAD_FRAME_BYTES);
+	}
+}
+
+static void reset()
+{
+	setupUART();
+	bytesOnWire = 0;
+	simIsrCount[SIM_USART_RX] = 0;
+}
+
+static void report(const char* name)
+{
+	uint32_t interrupts = simIsrCount[SIM_USART_RX];
+	// Bus kept busy: load is the share of the wire time spent in the ISR
+	double load = 100.0 * interrupts * rxCycles / ((double)bytesOnWire * simUartCharCycles());
+	printf("%-24s %6lu %6lu %7.2f%%\n", name, (unsigned long)bytesOnWire,
+		(unsigned long)interrupts, load);
+}
+
+/* --------------- Main --------------- */
+int main(int argc, char** argv)
+{
+	if (argc > 1) rxCycles = strtoul(argv[1], NULL, 0);
+	simIsrCycles[SIM_USART_RX] = rxCycles;
+	sei();
+
+	printf("Slave address %u, %u baud, 9-bit characters, RX ISR %lu cycles\n\n",
+		SLAVE_ADDRESS, BAUD, (unsigned long)rxCycles);
+	printf("%-24s %6s %6s %8s\n", "Upload", "Bytes", "RX ISR", "CPU");
+
+	reset();
+	CLEAR_BIT(UCSR0A, MPCM0); // Every character interrupts, as before addressing
+	upload(NO_ADDRESS);
+	report("MPCM off");
+
+	reset();
+	upload(SLAVE_ADDRESS);
+	report("To this slave");
+
+	reset();
+	upload(LINK_BROADCAST);
+	report("Broadcast");
+
+	reset();
+	upload(SLAVE_ADDRESS + 1);
+	report("To another slave");
+
+	// One upload per slave on the bus, each addressed to its own slave
+	printf("\n%-24s %6s %6s %8s\n", "Slaves on the bus", "Bytes", "RX ISR", "CPU");
+	for (uint8_t slaves = 2; slaves <= MAX_SLAVES; slaves *= 2)
+	{
+		char name[24];
+		reset();
+		for (uint8_t address = 1; address <= slaves; address++) upload(address);
+		snprintf(name, sizeof(name), "%u", slaves);
+		report(name);
+	}
+	return 0;
+}
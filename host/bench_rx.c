@@ -0,0 +1,284 @@
+// Receive path of the slave (device2.c): worst-case interrupt cycles, and the
+// fastest baud rate it takes back-to-back traffic at without losing a
+// character, to a data overrun in the USART (DOR0: a third character arrives
+// while its two level receive FIFO is full) or to a full receive queue.
+//
+// USART_RX_vect queues pattern bytes and the main loop parses them
+// (uartProcess). "In ISR" parses each byte inside the interrupt instead, as
+// before the queue. A frame sync only latches Timer1 in USART_RX_vect; its
+// frame step runs in TIMER1_COMPA_vect, forced right after. The step swaps in
+// a generator's next frame, which the main loop draws after it. Every path is
+// charged its worst case (a generator drawn at every frame step, though an
+// upload stops it), so the rates found are lower bounds.
+//
+// Cycle figures are estimated for avr-gcc -O2 code of each path; pass
+// measured ones to override (e.g. a spare pin toggled around each path):
+//   bench_rx [queue] [parse] [store] [sync] [sync step] [frame step] [draw] [row scan] [row off]
+//
+// Build: gcc -O2 -fgnu89-inline -Ihost -o bench_rx host/bench_rx.c host/sim_avr.c
+#include <stdio.h>
+
+#define main device2_main
+#define USART_RX_vect		slaveRxVect
+#define TIMER1_COMPA_vect	slaveFrameVect
+#include "../device2.c"
+#undef TIMER1_COMPA_vect
+#undef USART_RX_vect
+#undef main
+
+#define ADDRESS_BYTE(a)		(0x100 | (a)) // 9th bit set
+#define UPLOAD_FRAMES		20
+#define UPLOAD_DEPTH		4
+#define UPLOAD_FRAME_BYTES	5 // 3x3 LEDs, 4 bits each
+#define UNIT_CHARS(bytes)	(3 + (bytes)) // Address, sequence number, bytes, CRC
+#define UPLOAD_CHARS		(UNIT_CHARS(LINK_HEADER_SIZE) + UPLOAD_FRAMES * UNIT_CHARS(1 + UPLOAD_FRAME_BYTES))
+#define SYNC_PERIOD_MS		10 // Shortest frame
+#define RUN_MS				200
+
+// Worst case of each path: prologue and epilogue included
+enum { QUEUE, PARSE, STORE, SYNC, SYNC_STEP, STEP, DRAW, SCAN, SCAN_OFF, PATHS };
+static uint32_t cycles[PATHS] = {
+	70,		// USART_RX_vect: read status, 9th bit and byte, queue it
+	250,	// processUARTByte: one byte of a 4 bit frame (unpackByte)
+	550,	// storeFrame: bit planes of a frame once its last byte is in
+	130,	// USART_RX_vect: frame sync, latch Timer1 and force its compare match
+	600,	// TIMER1_COMPA_vect: after a sync, frame step, restart, streamSeek() and two frameTicks()
+	300,	// TIMER1_COMPA_vect: frame step, swap and frameTicks() (a multiply and a shift)
+	1500,	// renderGenerator (main loop): a generator's next step into the back buffer
+	110,	// TIMER0_COMPA_vect: row scan slice
+	40,		// TIMER0_COMPB_vect: row off
+};
+static const char* pathNames[PATHS] = {
+	"USART_RX_vect: queue a byte",
+	"Parse a byte (main loop, or in ISR)",
+	"  and a frame once complete",
+	"USART_RX_vect: frame sync",
+	"TIMER1_COMPA_vect: frame step at a sync",
+	"TIMER1_COMPA_vect: frame step",
+	"Draw a generator step (main loop)",
+	"TIMER0_COMPA_vect: row scan slice",
+	"TIMER0_COMPB_vect: row off",
+};
+
+static uint16_t upload[UPLOAD_CHARS];
+static uint8_t uploadStores[UPLOAD_CHARS]; // 1 -> the slave stores a frame at this character
+static uint8_t parseInIsr = 0;
+static uint8_t queueMost = 0;
+static uint32_t parsedBytes = 0; // Upload characters parsed, in order
+static uint32_t dataSent = 0; // Upload characters on the wire (addresses of this slave's units too)
+static uint32_t dataQueued = 0; // Of those, queued by USART_RX_vect
+static uint32_t dataOverruns = 0; // Characters lost to DOR0
+static uint8_t drawDue = 0; // Frame step taken, the main loop draws the next generator step
+
+// Parse what is queued, returns the cycles it takes: the CRC byte of each
+// frame stores it too
+static uint32_t parse()
+{
+	uint8_t tail = rxTail;
+	uint32_t total = 0;
+
+	uartProcess();
+	for (uint8_t parsed = (rxTail - tail) & (RX_BUFFER_SIZE - 1); parsed != 0; parsed--)
+	{
+		uint16_t position = parsedBytes++ % UPLOAD_CHARS;
+		total += cycles[PARSE];
+		if (uploadStores[position]) total += cycles[STORE];
+	}
+	return total;
+}
+
+// Charge each receive interrupt for the path it took
+void USART_RX_vect(void)
+{
+	uint8_t head = rxHead;
+	if (BIT_IS_SET(UCSR0A, DOR0)) dataOverruns++;
+	syncReportDue = 0;
+	slaveRxVect();
+
+	if (rxHead != head) dataQueued++;
+	uint8_t queued = (rxHead - rxTail) & (RX_BUFFER_SIZE - 1);
+	if (queued > queueMost) queueMost = queued;
+
+	simIsrCycles[SIM_USART_RX] = cycles[QUEUE];
+	if (syncReportDue)
+	{
+		simIsrCycles[SIM_USART_RX] = cycles[SYNC];
+	}
+	else if (rxHead != head && parseInIsr)
+	{
+		simIsrCycles[SIM_USART_RX] = cycles[QUEUE] + parse();
+	}
+}
+
+// Charge each frame step for the path it took
+void TIMER1_COMPA_vect(void)
+{
+	simIsrCycles[SIM_TIMER1_COMPA] = syncDue ? cycles[SYNC_STEP] : cycles[STEP];
+	slaveFrameVect();
+	drawDue = 1;
+}
+
+/* --------------- Traffic --------------- */
+// One upload to this slave as the master sends it: the header, then frames
+// of a time code and packed bytes, each unit after the slave's address
+static uint16_t buildUnit(uint16_t at, uint8_t sequence, const uint8_t* bytes, uint8_t length)
+{
+	uint8_t crc = _crc8_ccitt_update(0, sequence);
+
+	upload[at++] = ADDRESS_BYTE(SLAVE_ADDRESS);
+	upload[at++] = sequence;
+	for (uint8_t i = 0; i < length; i++)
+	{
+		upload[at++] = bytes[i];
+		crc = _crc8_ccitt_update(crc, bytes[i]);
+	}
+	upload[at++] = crc;
+	return at;
+}
+
+static void buildUpload()
+{
+	static const uint8_t header[LINK_HEADER_SIZE] = {LINK_VERSION, 3, 3, UPLOAD_FRAMES, UPLOAD_DEPTH | LINK_TIMED};
+	uint16_t at = buildUnit(0, LINK_SEQ_HEADER, header, LINK_HEADER_SIZE);
+
+	for (uint8_t frame = 0; frame < UPLOAD_FRAMES; frame++)
+	{
+		uint8_t bytes[1 + UPLOAD_FRAME_BYTES];
+		bytes[0] = 1; // 10 ms frames, any levels
+		for (uint8_t i = 1; i <= UPLOAD_FRAME_BYTES; i++) bytes[i] = frame * 37 + i * 11;
+		at = buildUnit(at, frame, bytes, sizeof(bytes));
+		uploadStores[at - 1] = 1;
+	}
+}
+
+// Uploads to this slave back-to-back, with the master's frame sync every
+// SYNC_PERIOD_MS (then LINK_RESUME when it cuts into a unit, as the master
+// sends it), until trafficEnd and the end of an upload
+static uint64_t trafficEnd = 0;
+static uint8_t trafficDone = 0;
+static uint64_t nextSync = 0;
+static uint8_t syncTicks = 0;
+static uint8_t syncIndex = 0;
+static uint16_t position = 0; // In the upload
+
+static uint16_t traffic()
+{
+	uint16_t data;
+
+	if (trafficDone || (position == 0 && syncIndex == 0 && simCycle >= trafficEnd))
+	{
+		// Other slaves' turn: ignored by this one
+		trafficDone = 1;
+		return ADDRESS_BYTE(SLAVE_ADDRESS + 1);
+	}
+	if (syncIndex || simCycle >= nextSync)
+	{
+		// Sync, then carry on with the unit it cut into
+		if (syncIndex == 0) nextSync += (uint64_t)F_CPU * SYNC_PERIOD_MS / 1000;
+		if (syncIndex < 2 || !(upload[position] & ADDRESS_BYTE(0)))
+		{
+			data = syncIndex == 0 ? ADDRESS_BYTE(LINK_SYNC) : syncIndex == 1 ? syncTicks++ & SYNC_TICK_MASK :
+				ADDRESS_BYTE(LINK_RESUME);
+			syncIndex = (syncIndex + 1) % 3;
+			return data;
+		}
+		syncIndex = 0;
+	}
+
+	data = upload[position];
+	dataSent++;
+	if (++position == UPLOAD_CHARS) position = 0;
+	return data;
+}
+
+/* --------------- Run --------------- */
+// Upload characters lost over RUN_MS of traffic at one UBRR0 setting
+// (dataOverruns of them to DOR0)
+static uint32_t run(uint16_t ubrr, uint8_t inIsr)
+{
+	setupUART();
+	UBRR0 = ubrr;
+	parseInIsr = inIsr;
+	queueMost = 0;
+	rxOverruns = 0;
+	dataOverruns = 0;
+	dataSent = 0;
+	dataQueued = 0;
+	parsedBytes = 0;
+	nextSync = simCycle;
+	trafficEnd = simCycle + (uint64_t)F_CPU * RUN_MS / 1000;
+	trafficDone = 0;
+
+	simSetRxSource(traffic);
+	while (!trafficDone || rxTail != rxHead)
+	{
+		// Main loop: parse what is queued and draw a generator step after a
+		// frame step, taking their time, or sleep
+		uint32_t busy = parse();
+		if (drawDue) busy += cycles[DRAW];
+		drawDue = 0;
+		if (busy) simAdvance(busy);
+		else simSleep();
+	}
+	simSetRxSource(NULL);
+	simAdvance(2 * simUartCharCycles());
+	parse();
+
+	return dataSent - dataQueued;
+}
+
+/* --------------- Main --------------- */
+int main(int argc, char** argv)
+{
+	static const uint16_t ubrrs[] = {103, 51, 34, 25, 16, 12, 8, 7, 6, 5, 4, 3, 2, 1, 0};
+	uint32_t fastest[2] = {0, 0};
+	uint8_t failed[2] = {0, 0};
+
+	for (int i = 1; i < argc && i <= PATHS; i++) cycles[i - 1] = strtoul(argv[i], NULL, 0);
+	buildUpload();
+
+	setupLEDs();
+	setupTimers();
+	setupUART();
+	simIsrCycles[SIM_TIMER0_COMPA] = cycles[SCAN];
+	simIsrCycles[SIM_TIMER0_COMPB] = cycles[SCAN_OFF];
+	sei();
+
+	printf("Worst-case interrupt cycles (estimates, at %lu MHz)\n", F_CPU / 1000000);
+	printf("%-40s %6s %8s\n", "Path", "Cycles", "us");
+	for (uint8_t path = 0; path < PATHS; path++)
+	{
+		printf("%-40s %6lu %8.1f\n", pathNames[path], (unsigned long)cycles[path], cycles[path] * 1e6 / F_CPU);
+	}
+	uint32_t before = cycles[QUEUE] + cycles[PARSE] + cycles[STORE];
+	printf("%-40s %6lu %8.1f\n", "USART_RX_vect: parse in ISR (before)", (unsigned long)before, before * 1e6 / F_CPU);
+
+	printf("\nBack-to-back uploads to slave %u, %u ms frame sync, 9-bit characters, %u ms each\n",
+		SLAVE_ADDRESS, SYNC_PERIOD_MS, RUN_MS);
+	printf("%4s %8s %6s | %-13s | %-22s\n", "", "", "Char", "Parse in ISR", "Queued");
+	printf("%4s %8s %6s | %6s %6s | %6s %6s %8s\n", "UBRR", "Baud", "cycles", "Lost", "DOR0", "Lost", "DOR0", "Most in");
+	for (uint8_t i = 0; i < sizeof(ubrrs) / sizeof(ubrrs[0]); i++)
+	{
+		uint32_t lost[2];
+		uint32_t overruns[2];
+		lost[0] = run(ubrrs[i], 1);
+		overruns[0] = dataOverruns;
+		lost[1] = run(ubrrs[i], 0);
+		overruns[1] = dataOverruns;
+
+		UBRR0 = ubrrs[i];
+		uint32_t baud = F_CPU / 16 / (ubrrs[i] + 1);
+		printf("%4u %8lu %6lu | %6lu %6lu | %6lu %6lu %8u\n", ubrrs[i], (unsigned long)baud,
+			(unsigned long)simUartCharCycles(), (unsigned long)lost[0], (unsigned long)overruns[0],
+			(unsigned long)lost[1], (unsigned long)overruns[1], queueMost);
+		for (uint8_t mode = 0; mode < 2; mode++)
+		{
+			if (lost[mode]) failed[mode] = 1;
+			else if (!failed[mode]) fastest[mode] = baud;
+		}
+	}
+	printf("\nFastest without losing a character: %lu baud parsing in the ISR, %lu baud queued\n",
+		(unsigned long)fastest[0], (unsigned long)fastest[1]);
+
+	return 0;
+}
@@ -0,0 +1,99 @@
+// Frame sync drift for the slave (device2.c)
+// Sends the master's frame sync to the simulated USART once per master frame
+// and reports syncDrift, the Timer1 ticks the slave's frame clock was off at
+// each sync, for a slave starting out of phase and running off a clock that
+// is fast or slow against the master's (resonators are within about 0.5%).
+//
+// Build: gcc -O2 -fgnu89-inline -Ihost -o bench_sync host/bench_sync.c host/sim_avr.c
+#include <stdio.h>
+#include <string.h>
+
+#define main device2_main
+#include "../device2.c"
+#undef main
+
+#define FRAME_TICKS			((unsigned long)frameTicks(FRAME_TIME_DEFAULT)) // Timer1 compare match, 1 s frames
+#define START_PHASE_TICKS	4687 // Slave's counter at the master's first boundary (0.3 s)
+#define SYNCS				8
+#define FREE_RUN_S			60
+
+static const int32_t ppms[] = {0, 1000, -1000, 5000, -5000};
+#define SCENARIOS			(sizeof(ppms) / sizeof(ppms[0]))
+
+static int16_t drifts[SCENARIOS][SYNCS];
+
+// Run up to a point in time
+static void advanceTo(uint64_t cycle)
+{
+	if (simCycle < cycle) simAdvance(cycle - simCycle);
+}
+
+// Slave clock ppm fast against the master -> master frames take longer in slave cycles
+static void run(uint8_t scenario)
+{
+	double period = (double)FRAME_TICKS * FRAME_PRESCALER * (1.0 + ppms[scenario] * 1e-6);
+	uint64_t start = simCycle;
+
+	TCNT1 = START_PHASE_TICKS;
+	for (uint8_t sync = 0; sync < SYNCS; sync++)
+	{
+		// Master's frame boundary, then its sync on the wire
+		uint64_t boundary = start + (uint64_t)(sync * period);
+		advanceTo(boundary + simUartCharCycles());
+		simReceive(0x100 | LINK_SYNC);
+		advanceTo(boundary + 2 * simUartCharCycles());
+		simReceive(sync & SYNC_TICK_MASK);
+		simAdvance(2 * FRAME_PRESCALER); // RX interrupt
+		drifts[scenario][sync] = syncDrift;
+	}
+}
+
+/* --------------- Main --------------- */
+int main()
+{
+	setupTimers();
+	setupUART();
+	// Interrupts take no time (they are charged on top of simAdvance()), so
+	// the master's boundaries land exactly where they are placed
+	memset(simIsrCycles, 0, sizeof(simIsrCycles));
+	sei();
+
+	printf("Timer1 prescaler %u: %.0f us per tick, %lu ticks per frame, sync latency %lu ticks\n",
+		FRAME_PRESCALER, 1e6 * FRAME_PRESCALER / F_CPU, FRAME_TICKS, (unsigned long)syncLatency);
+	printf("Slave starts %u ticks into its frame, ticks off at each sync (> 0 -> slave ahead)\n\n",
+		START_PHASE_TICKS);
+
+	for (uint8_t scenario = 0; scenario < SCENARIOS; scenario++) run(scenario);
+
+	printf("%-12s |", "Slave clock");
+	for (uint8_t scenario = 0; scenario < SCENARIOS; scenario++) printf(" %+7ld ppm", (long)ppms[scenario]);
+	printf("\n");
+	for (uint8_t sync = 0; sync < SYNCS; sync++)
+	{
+		printf("Sync %-7u |", sync);
+		for (uint8_t scenario = 0; scenario < SCENARIOS; scenario++) printf(" %11d", drifts[scenario][sync]);
+		printf("\n");
+	}
+
+	// Worst tear once locked (every sync after the first), against no sync at all
+	printf("%-12s |", "Locked, ms");
+	for (uint8_t scenario = 0; scenario < SCENARIOS; scenario++)
+	{
+		int16_t most = 0;
+		for (uint8_t sync = 1; sync < SYNCS; sync++)
+		{
+			int16_t drift = drifts[scenario][sync] < 0 ? -drifts[scenario][sync] : drifts[scenario][sync];
+			if (drift > most) most = drift;
+		}
+		printf(" %11.2f", most * 1e3 * FRAME_PRESCALER / F_CPU);
+	}
+	printf("\n%-12s |", "Free, ms");
+	for (uint8_t scenario = 0; scenario < SCENARIOS; scenario++)
+	{
+		double drift = FREE_RUN_S * 1e3 * ppms[scenario] * 1e-6;
+		printf(" %11.2f", drift < 0 ? -drift : drift);
+	}
+	printf("   (after %u s without sync)\n", FREE_RUN_S);
+
+	return 0;
+}
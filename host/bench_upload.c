@@ -0,0 +1,110 @@
+// Pattern upload benchmark for the master (device1.c)
+// Runs the real transmitter code against the simulated USART and reports
+// bytes/s and time-to-upload for every entry in mtrxPatterns. A pattern too
+// long for the slaves (*) is streamed while it plays: its upload is the
+// prefill, until every slave's ring is full and the pattern starts.
+//
+// Build: gcc -O2 -fgnu89-inline -Ihost -o bench_upload host/bench_upload.c host/sim_avr.c
+#include <stdio.h>
+
+#define main device1_main
+#include "../device1.c"
+#undef main
+
+// Main loop period of device1.c, one pass per _delay_ms(10)
+#define LOOP_PERIOD_MS		10
+
+static uint32_t bytesOnWire = 0;
+
+// Pattern still queued, in the transmit buffer or on the wire
+static int uploading()
+{
+	return startTransmit || txHead != txTail || !simUartTxIdle();
+}
+
+// Every unit comes in right, so each slave answers a poll that it has the
+// whole pattern as soon as the poll is off the wire
+static void countByte(uint16_t data)
+{
+	static uint8_t polled = 0;
+
+	if (polled && !(data & LINK_ADDRESS_BIT)) simReceive(LINK_POLL_DONE);
+	polled = data == (LINK_ADDRESS_BIT | LINK_POLL);
+	bytesOnWire++;
+}
+
+/* --------------- Before --------------- */
+// The original uartProcess() sent the ASCII strings and handed one byte to
+// USART_UDRE_vect per main loop pass, so every byte cost a full LOOP_PERIOD_MS.
+static uint32_t legacyBytes(int patternNo)
+{
+	uint32_t bytes = 0;
+	prepareMessage(patternNo);
+	for (int timestep = 0; messagesToSend[timestep] != NULL; timestep++)
+	{
+		bytes += strcspn(messagesToSend[timestep], ";@") + 1;
+	}
+	return bytes + 2; // EOT + NULL
+}
+
+/* --------------- After --------------- */
+// Same loop as main(): uartProcess() then _delay_ms(), until the last stop
+// bit has left the TX pin. Returns the upload time in CPU cycles.
+// Timer1 is not running, so a stream gets no credits past its prefill.
+static uint64_t upload(int patternNo)
+{
+	uint64_t start = simCycle;
+
+	prepareMessage(patternNo);
+	startTransmit = 1;
+
+	while (uploading())
+	{
+		uartProcess();
+
+		// Stop the clock as soon as the line goes quiet
+		for (int ms = 0; ms < LOOP_PERIOD_MS && uploading(); ms++)
+		{
+			_delay_ms(1);
+		}
+	}
+
+	return simCycle - start;
+}
+
+/* --------------- Main --------------- */
+int main()
+{
+	uartSetup();
+	sei();
+	simSetTxHandler(countByte);
+
+	printf("USART %lu baud, %lu cycles per character\n\n",
+		(unsigned long)(F_CPU / 16 / (UBRR0 + 1)), (unsigned long)simUartCharCycles());
+	printf("%-16s | %6s %10s %8s | %6s %10s %8s | %7s\n", "",
+		"Before", "", "", "After", "", "", "");
+	printf("%-16s | %6s %10s %8s | %6s %10s %8s | %7s\n", "Pattern",
+		"Bytes", "ms", "Bytes/s", "Bytes", "ms", "Bytes/s", "Speedup");
+
+	for (int patternNo = 0; patternNo < numMtrxPatterns; patternNo++)
+	{
+		char name[19]; // Name and " *"
+		patternName(patternNo, name, sizeof(name));
+		prepareMessage(patternNo);
+		if (streamToSend != NULL) strcat(name, " *");
+		uint32_t before = legacyBytes(patternNo);
+		double beforeMs = before * LOOP_PERIOD_MS;
+
+		bytesOnWire = 0;
+		double afterMs = upload(patternNo) * 1000.0 / F_CPU;
+
+		printf("%-16s | %6lu %10.1f %8.1f | %6lu %10.1f %8.1f | %6.1fx\n",
+			name,
+			(unsigned long)before, beforeMs, before * 1000.0 / beforeMs,
+			(unsigned long)bytesOnWire, afterMs, bytesOnWire * 1000.0 / afterMs,
+			beforeMs / afterMs);
+	}
+	printf("\n* Streamed (%u frames per slave ring): bytes and time of the prefill\n", STREAM_FRAMES);
+
+	return 0;
+}
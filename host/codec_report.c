@@ -0,0 +1,166 @@
+// Frame encoding report for the pattern uplink (device1.c)
+// For every entry in mtrxPatterns, shows which encoding encodeFrame() picks
+// for each slave tile of each frame, the size of the pattern with every frame encoded, and the
+// bytes actually sent (encoded only when that is shorter than packed, or a
+// generator packet for patterns the slaves draw themselves). Patterns too
+// long for the slaves are streamed while they play and left out.
+// Packed, encoded and sent count the bytes of headers, frames and generator
+// packets alike; the framing around them on the wire (each unit's address,
+// sequence number and CRC, and the polls: three per tile here, as no slave
+// answers) is its own column.
+//
+// Build: gcc -O2 -fgnu89-inline -Ihost -o codec_report host/codec_report.c host/sim_avr.c
+#include <stdio.h>
+
+#define main device1_main
+#include "../device1.c"
+#undef main
+
+static uint32_t bytesOnWire = 0; // Unit contents
+static uint32_t framingOnWire = 0;
+static uint16_t selected = 0; // Last address on the wire
+static uint32_t unitChars = 0; // Characters after it
+
+// Pattern still queued, in the transmit buffer or on the wire
+static int uploading()
+{
+	return startTransmit || txHead != txTail || !simUartTxIdle();
+}
+
+// Characters after the last address: a poll's slave address, or a unit's
+// sequence number, contents and CRC
+static void countUnit()
+{
+	if (selected == (LINK_ADDRESS_BIT | LINK_POLL) || unitChars < 2)
+	{
+		framingOnWire += unitChars;
+	}
+	else
+	{
+		framingOnWire += 2;
+		bytesOnWire += unitChars - 2;
+	}
+	unitChars = 0;
+}
+
+static void countByte(uint16_t data)
+{
+	if (data & LINK_ADDRESS_BIT)
+	{
+		countUnit();
+		selected = data;
+		framingOnWire++;
+	}
+	else
+	{
+		unitChars++;
+	}
+}
+
+// Sent: counted off the simulated TX pin while uartProcess() runs
+static uint32_t sentBytes(int patternNo)
+{
+	bytesOnWire = 0;
+	framingOnWire = 0;
+	selected = 0;
+
+	prepareMessage(patternNo);
+	startTransmit = 1;
+	while (uploading())
+	{
+		uartProcess();
+		_delay_ms(1);
+	}
+	countUnit();
+
+	return bytesOnWire;
+}
+
+// Encoding of each tile of each frame, same sequence as uartProcess() sends
+// Returns the pattern size with every frame encoded
+static uint32_t countTypes(uint8_t* key, uint8_t* delta, uint8_t* rle)
+{
+	uint32_t bytes = 0;
+	*key = *delta = *rle = 0;
+
+	for (uint8_t tile = 0; tile < NUM_TILES; tile++)
+	{
+		uint8_t previous[MAX_FRAME_BYTES] = {0};
+		bytes += LINK_HEADER_SIZE;
+		for (int timestep = 0; messagesToSend[timestep] != NULL; timestep++)
+		{
+			uint8_t frame[MAX_FRAME_BYTES];
+			uint8_t coded[1 + MAX_FRAME_BYTES];
+			packFrame(messagesToSend[timestep], frame, depthToSend, slaveTiles[tile]);
+			bytes += timedToSend; // Duration code
+			bytes += encodeFrame(frame, previous, TILE_BYTES(slaveTiles[tile], depthToSend), coded);
+			memcpy(previous, frame, sizeof(previous));
+
+			switch (coded[0] & ~FRAME_PAIRS_MASK)
+			{
+				case FRAME_DELTA: (*delta)++; break;
+				case FRAME_RLE: (*rle)++; break;
+				default: (*key)++; break;
+			}
+		}
+	}
+	return bytes;
+}
+
+// Packed: per tile the header, then every frame in full with no encoding byte
+// (after its duration code if the pattern is timed)
+static uint32_t packedBytes()
+{
+	uint32_t bytes = 0;
+	for (uint8_t tile = 0; tile < NUM_TILES; tile++)
+	{
+		bytes += LINK_HEADER_SIZE +
+			(uint32_t)numFramesToSend * (timedToSend + TILE_BYTES(slaveTiles[tile], depthToSend));
+	}
+	return bytes;
+}
+
+int main()
+{
+	uartSetup();
+	sei();
+	simSetTxHandler(countByte);
+
+	printf("%-16s %6s %5s | %3s %5s %3s | %6s %7s %6s | %5s | %7s\n",
+		"Pattern", "Frames", "Depth", "Key", "Delta", "RLE", "Packed", "Encoded", "Sent", "Ratio", "Framing");
+
+	uint32_t totalPacked = 0;
+	uint32_t totalEncoded = 0;
+	uint32_t totalSent = 0;
+	uint32_t totalFraming = 0;
+	for (int patternNo = 0; patternNo < numMtrxPatterns; patternNo++)
+	{
+		char name[17];
+		patternName(patternNo, name, sizeof(name));
+		prepareMessage(patternNo);
+		if (streamToSend != NULL)
+		{
+			printf("%-16s %6s %5s | streamed while it plays\n", name, "", "");
+			continue;
+		}
+		uint32_t sent = sentBytes(patternNo);
+		uint32_t packed = packedBytes();
+		uint8_t key, delta, rle;
+		uint32_t encoded = countTypes(&key, &delta, &rle);
+		totalPacked += packed;
+		totalEncoded += encoded;
+		totalSent += sent;
+		totalFraming += framingOnWire;
+
+		printf("%-16s %6u %5u | %3u %5u %3u | %6lu %7lu %6lu | %5.2f | %7lu\n",
+			name, numFramesToSend, depthToSend,
+			key, delta, rle, (unsigned long)packed, (unsigned long)encoded,
+			(unsigned long)sent, (double)packed / sent, (unsigned long)framingOnWire);
+	}
+
+	printf("%-16s %6s %5s | %3s %5s %3s | %6lu %7lu %6lu | %5.2f | %7lu\n", "Total", "", "",
+		"", "", "", (unsigned long)totalPacked, (unsigned long)totalEncoded,
+		(unsigned long)totalSent, (double)totalPacked / totalSent, (unsigned long)totalFraming);
+
+	return 0;
+}
@@ -0,0 +1,120 @@
+// Bytes-on-wire report for the pattern uplink (device1.c)
+// Compares the old ASCII "100000," strings against the binary wire format
+// the transmitter sends now, for every entry in mtrxPatterns. Per slave is
+// the most characters any one slave's receiver takes in: address bytes, and
+// data while its tile (or a broadcast) is selected. Patterns too long for
+// the slaves are streamed while they play and left out (see bench_upload).
+//
+// Build: gcc -O2 -fgnu89-inline -Ihost -o link_report host/link_report.c host/sim_avr.c
+#include <stdio.h>
+
+#define main device1_main
+#include "../device1.c"
+#undef main
+
+static uint32_t bytesOnWire = 0;
+static uint32_t slaveBytes[NUM_TILES];
+static int16_t selected = LINK_BROADCAST;
+
+// Pattern still queued, in the transmit buffer or on the wire
+static int uploading()
+{
+	return startTransmit || txHead != txTail || !simUartTxIdle();
+}
+
+// Every unit comes in right, so each slave answers a poll that it has the
+// whole pattern as soon as the poll is off the wire
+static void countByte(uint16_t data)
+{
+	if (selected == LINK_POLL && !(data & LINK_ADDRESS_BIT)) simReceive(LINK_POLL_DONE);
+	bytesOnWire++;
+	if (data & LINK_ADDRESS_BIT) selected = data & 0xFF;
+	for (uint8_t tile = 0; tile < NUM_TILES; tile++)
+	{
+		if ((data & LINK_ADDRESS_BIT) || selected == LINK_BROADCAST ||
+			selected == slaveTiles[tile][TILE_ADDRESS]) slaveBytes[tile]++;
+	}
+}
+
+static uint32_t perSlaveBytes()
+{
+	uint32_t most = 0;
+	for (uint8_t tile = 0; tile < NUM_TILES; tile++)
+	{
+		if (slaveBytes[tile] > most) most = slaveBytes[tile];
+	}
+	return most;
+}
+
+// Old format: each frame as a NULL terminated string, then EOT + NULL
+static uint32_t asciiBytes(int patternNo)
+{
+	uint32_t bytes = 0;
+	prepareMessage(patternNo);
+	for (int timestep = 0; messagesToSend[timestep] != NULL; timestep++)
+	{
+		bytes += strcspn(messagesToSend[timestep], ";@") + 1;
+	}
+	return bytes + 2;
+}
+
+// New format: counted off the simulated TX pin while uartProcess() runs
+static uint32_t binaryBytes(int patternNo)
+{
+	bytesOnWire = 0;
+	memset(slaveBytes, 0, sizeof(slaveBytes));
+
+	prepareMessage(patternNo);
+	startTransmit = 1;
+	while (uploading())
+	{
+		// Main loop pass of device1.c (polls are answered within two)
+		uartProcess();
+		_delay_ms(10);
+	}
+
+	return bytesOnWire;
+}
+
+int main()
+{
+	uartSetup();
+	sei();
+	simSetTxHandler(countByte);
+
+	printf("%-16s %6s | %6s %6s | %6s %9s | %9s\n",
+		"Pattern", "Frames", "ASCII", "Binary", "Saved", "Reduction", "Per slave");
+
+	uint32_t totalAscii = 0;
+	uint32_t totalBinary = 0;
+	uint32_t totalSlave = 0;
+	for (int patternNo = 0; patternNo < numMtrxPatterns; patternNo++)
+	{
+		char name[17];
+		patternName(patternNo, name, sizeof(name));
+		prepareMessage(patternNo);
+		if (streamToSend != NULL)
+		{
+			printf("%-16s %6s | streamed while it plays\n", name, "");
+			continue;
+		}
+		uint32_t ascii = asciiBytes(patternNo);
+		uint32_t binary = binaryBytes(patternNo);
+		totalAscii += ascii;
+		totalBinary += binary;
+		totalSlave += perSlaveBytes();
+
+		printf("%-16s %6u | %6lu %6lu | %6lu %8.1f%% | %9lu\n",
+			name, numFramesToSend,
+			(unsigned long)ascii, (unsigned long)binary,
+			(unsigned long)(ascii - binary), 100.0 * (ascii - binary) / ascii,
+			(unsigned long)perSlaveBytes());
+	}
+
+	printf("%-16s %6s | %6lu %6lu | %6lu %8.1f%% | %9lu\n", "Total", "",
+		(unsigned long)totalAscii, (unsigned long)totalBinary,
+		(unsigned long)(totalAscii - totalBinary), 100.0 * (totalAscii - totalBinary) / totalAscii,
+		(unsigned long)totalSlave);
+
+	return 0;
+}
@@ -0,0 +1,551 @@
+// Full sign on the host: the master (device1.c) and both slaves (device2.c,
+// each in a sign_slave process), all three unmodified, joined by simulated
+// UART wires and stepped in lockstep one character time of the master at a
+// time (sign_sim.h). A character sent at another rate than the receiver's
+// comes in garbled and is dropped; slave answers in the same step collide on
+// their shared wire. Slave answers reach the master up to one step late.
+//
+// The potentiometer is set to a pattern and the button pressed once the link
+// rate is negotiated. The 6x3 sign is drawn on the terminal whenever it
+// changes (each LED's brightness over RENDER_MS against a row lit all the
+// time), and as PPM images into a directory if one is given. At the end the
+// time from the button press to the new pattern lit on both slaves is shown.
+// A master without inputs (device1_final.c) uploads its pattern at startup,
+// which is timed instead.
+//
+// -j prints the figures as JSON instead, for comparing runs: the interrupts
+// each device took and an estimate of the cycles they cost (the estimated_
+// fields: runs times each handler's cycles per run from sign_sim.h, not
+// measured, as "isr_cycles" in the JSON says), the share of time each was
+// asleep or in a busy wait, each slave's full frames per second of the row
+// scan, the upload's time and characters on the wire, and each LED's
+// integrated on time per second once the new pattern is lit.
+//
+// -v writes a VCD trace of each device into a directory, for GTKWave:
+// master.vcd, slave1.vcd and slave2.vcd, on one time base. Each has the
+// port pins (a slave's rows on PC0-PC2 and columns on PD5-PD7), its USART
+// lines and when each interrupt handler ran.
+//   sign_sim [-j] [-v VCD directory] [pattern] [run ms] [PPM directory]
+//
+// Build (sign_slave next to sign_sim):
+//   gcc -O2 -fgnu89-inline -Ihost -o sign_sim host/sign_sim.c host/sim_avr.c
+//   gcc -O2 -fgnu89-inline -Ihost -o sign_slave host/sign_slave.c host/sim_avr.c
+// (-DMASTER_SOURCE='"../device1_final.c"' for another firmware source, and
+// SLAVE_SOURCE for sign_slave: make bench builds and runs the final ones)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#ifndef MASTER_SOURCE
+#define MASTER_SOURCE	"../device1.c"
+#endif
+
+#define main device1_main
+#include MASTER_SOURCE
+#undef main
+
+#include "sign_sim.h"
+
+#define SLAVES				2 // Side by side, addresses 1 and 2
+#define SIGN_WIDTH			(SLAVES * SIGN_COLS)
+#define RENDER_MS			20
+#define PRESS_AFTER_MS		100 // Button pressed this long after the link rate is settled
+#define PRESS_MS			30 // and held (debounced over three Timer0 overflows)
+#define RUN_MS				3000
+#define PPM_SCALE			24 // Pixels per LED
+#define MS(ms)				((uint64_t)(ms) * (F_CPU / 1000))
+
+static const char ramp[] = " .:-=+*#%@";
+#define RAMP_LEVELS			(sizeof(ramp) - 1)
+
+static int pattern = 0;
+static uint64_t runEnd = MS(RUN_MS);
+static const char* ppmDirectory = NULL;
+static uint8_t json = 0;
+static const char* vcdDirectory = NULL;
+
+static int slaveIn[SLAVES]; // Steps to each slave
+static int slaveOut[SLAVES]; // Its reports
+static pid_t slavePids[SLAVES];
+static signStep step; // The master's TX this step
+
+static uint64_t negotiated = 0; // Link rate settled (frame clock started)
+static uint64_t pressAt = 0;
+static uint64_t doneAt[SLAVES]; // Slave answered a poll that it has the whole upload
+static uint64_t shownAt[SLAVES]; // New pattern lit, after the upload started
+static uint32_t uploadChars = 0; // Master characters on the wire until every slave has it
+static uint32_t garbled = 0; // Characters sent at another rate
+static uint32_t collided = 0; // Slave answers on the wire at once
+
+static uint64_t onCycles[SIGN_ROWS][SIGN_WIDTH]; // Each LED lit in the render window
+static uint64_t patternOnCycles[SIGN_ROWS][SIGN_WIDTH]; // and since the new pattern is lit on the whole sign
+static uint64_t windowStart = 0;
+static char shownImage[SIGN_ROWS][SIGN_WIDTH + 1];
+static uint32_t framesDrawn = 0;
+static uint32_t framesWritten = 0;
+
+/* --------------- Slaves --------------- */
+// sign_slave in the directory of this program, one process per address
+static void slavesStart(const char* self)
+{
+	char path[4096];
+	const char* slash = strrchr(self, '/');
+	int length = slash ? (int)(slash - self + 1) : 0;
+	snprintf(path, sizeof(path), "%.*ssign_slave", length, self);
+
+	for (uint8_t slave = 0; slave < SLAVES; slave++)
+	{
+		int in[2], out[2];
+		if (pipe(in) || pipe(out))
+		{
+			perror("pipe");
+			exit(1);
+		}
+		slavePids[slave] = fork();
+		if (slavePids[slave] == 0)
+		{
+			char address[4];
+			snprintf(address, sizeof(address), "%u", slave + 1);
+			dup2(in[0], STDIN_FILENO);
+			dup2(out[1], STDOUT_FILENO);
+			close(in[0]);
+			close(in[1]);
+			close(out[0]);
+			close(out[1]);
+			// The other slaves' ends stay with the master (their EOF ends them)
+			for (uint8_t other = 0; other < slave; other++)
+			{
+				close(slaveIn[other]);
+				close(slaveOut[other]);
+			}
+			execl(path, path, address, vcdDirectory, (char*)NULL);
+			perror(path);
+			_exit(1);
+		}
+		close(in[0]);
+		close(out[1]);
+		slaveIn[slave] = in[1];
+		slaveOut[slave] = out[0];
+	}
+}
+
+static void slavesStop()
+{
+	for (uint8_t slave = 0; slave < SLAVES; slave++)
+	{
+		close(slaveIn[slave]);
+		close(slaveOut[slave]);
+		waitpid(slavePids[slave], NULL, 0);
+	}
+}
+
+static void reportRead(uint8_t slave, signReport* report)
+{
+	uint8_t* at = (uint8_t*)report;
+	size_t left = sizeof(*report);
+
+	while (left)
+	{
+		ssize_t got = read(slaveOut[slave], at, left);
+		if (got <= 0)
+		{
+			fprintf(stderr, "Slave %u stopped (sign_slave built next to sign_sim?)\n", slave + 1);
+			exit(1);
+		}
+		at += got;
+		left -= got;
+	}
+}
+
+static void masterSent(uint16_t data)
+{
+	if (step.count == SIGN_STEP_CHARS) return;
+	step.chars[step.count].cycle = simCycle;
+	step.chars[step.count].charCycles = simUartCharCycles();
+	step.chars[step.count].data = data;
+	step.count++;
+}
+
+/* --------------- Sign --------------- */
+// Brightness of one LED over the window, one row lit all the time -> 1
+static uint8_t ledLevelDrawn(uint8_t row, uint8_t col, uint64_t window)
+{
+	uint64_t level = (onCycles[row][col] * SIGN_ROWS * (RAMP_LEVELS - 1) + window / 2) / window;
+	return level < RAMP_LEVELS ? level : RAMP_LEVELS - 1;
+}
+
+static void ppmWrite(uint64_t window)
+{
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/frame_%05lu.ppm", ppmDirectory, (unsigned long)framesWritten++);
+	FILE* file = fopen(path, "wb");
+	if (!file)
+	{
+		perror(path);
+		exit(1);
+	}
+
+	fprintf(file, "P6\n%u %u\n255\n", SIGN_WIDTH * PPM_SCALE, SIGN_ROWS * PPM_SCALE);
+	for (uint16_t y = 0; y < SIGN_ROWS * PPM_SCALE; y++)
+	{
+		for (uint16_t x = 0; x < SIGN_WIDTH * PPM_SCALE; x++)
+		{
+			// Round LEDs on a dark board
+			int dx = x % PPM_SCALE - PPM_SCALE / 2, dy = y % PPM_SCALE - PPM_SCALE / 2;
+			uint8_t red = 24;
+			if (dx * dx + dy * dy <= PPM_SCALE * PPM_SCALE / 9)
+			{
+				red = 40 + ledLevelDrawn(y / PPM_SCALE, x / PPM_SCALE, window) * 215 / (RAMP_LEVELS - 1);
+			}
+			fputc(red, file);
+			fputc(red / 8, file);
+			fputc(red / 8, file);
+		}
+	}
+	fclose(file);
+}
+
+// Sign over the last window: on the terminal when it changed, and to PPM
+static void render()
+{
+	uint64_t window = simCycle - windowStart;
+	char image[SIGN_ROWS][SIGN_WIDTH + 1];
+
+	for (uint8_t row = 0; row < SIGN_ROWS; row++)
+	{
+		for (uint8_t col = 0; col < SIGN_WIDTH; col++) image[row][col] = ramp[ledLevelDrawn(row, col, window)];
+		image[row][SIGN_WIDTH] = 0;
+	}
+	if (ppmDirectory) ppmWrite(window);
+
+	if (memcmp(image, shownImage, sizeof(image)) && !json)
+	{
+		memcpy(shownImage, image, sizeof(image));
+		printf("%9.1f ms  |%s|\n", simCycle * 1e3 / F_CPU, image[0]);
+		for (uint8_t row = 1; row < SIGN_ROWS; row++) printf("%14s|%s|\n", "", image[row]);
+		framesDrawn++;
+	}
+
+	memset(onCycles, 0, sizeof(onCycles));
+	windowStart = simCycle;
+}
+
+/* --------------- Results --------------- */
+// Upload starts at the button press, or once the link rate is settled on a
+// master without inputs (0 -> not yet known)
+static uint64_t uploadFrom()
+{
+	if (!negotiated) return 0;
+	return BIT_IS_SET(ADCSRA, ADEN) ? pressAt : negotiated;
+}
+
+// Latest of the slaves' times, 0 if one has none
+static uint64_t slavesLatest(const uint64_t* at)
+{
+	uint64_t latest = 0;
+	for (uint8_t slave = 0; slave < SLAVES; slave++)
+	{
+		if (!at[slave]) return 0;
+		if (at[slave] > latest) latest = at[slave];
+	}
+	return latest;
+}
+
+static double toMs(uint64_t cycles)
+{
+	return cycles * 1e3 / F_CPU;
+}
+
+// Integrated on time of one LED with the new pattern lit, ms per second
+static double ledOnMs(uint8_t row, uint8_t col)
+{
+	uint64_t shown = slavesLatest(shownAt);
+	if (!shown || simCycle <= shown) return 0;
+	return patternOnCycles[row][col] * 1e3 / (simCycle - shown);
+}
+
+static void slavesTotals(signTotals* totals)
+{
+	signStep last;
+
+	memset(&last, 0, sizeof(last));
+	last.until = simCycle;
+	last.count = SIGN_STEP_END;
+	for (uint8_t slave = 0; slave < SLAVES; slave++)
+	{
+		uint8_t* at = (uint8_t*)&totals[slave];
+		size_t left = sizeof(totals[slave]);
+
+		if (write(slaveIn[slave], &last, sizeof(last)) != sizeof(last)) exit(1);
+		while (left)
+		{
+			ssize_t got = read(slaveOut[slave], at, left);
+			if (got <= 0) exit(1);
+			at += got;
+			left -= got;
+		}
+	}
+}
+
+static void deviceJson(const char* name, uint64_t cycles, uint64_t idle, const uint32_t* isrCount,
+	const uint16_t* isrCycles, int32_t scans)
+{
+	const char* separator = "";
+
+	printf("\t\t{\"device\": \"%s\", \"idle_percent\": %.2f, ", name, 100.0 * idle / cycles);
+	if (scans >= 0) printf("\"refresh_hz\": %.1f, ", scans * (double)F_CPU / cycles);
+	printf("\"isr\": {");
+	for (uint8_t vector = 0; vector < SIM_NUM_VECTORS; vector++)
+	{
+		if (!isrCount[vector]) continue;
+		printf("%s\"%s\": {\"runs\": %lu, \"estimated_cycles\": %llu, \"estimated_cpu_percent\": %.3f}", separator,
+			simVectorNames[vector], (unsigned long)isrCount[vector],
+			(unsigned long long)isrCount[vector] * isrCycles[vector],
+			100.0 * isrCount[vector] * isrCycles[vector] / cycles);
+		separator = ", ";
+	}
+	printf("}}");
+}
+
+static void printJson(const signTotals* totals)
+{
+	uint64_t from = uploadFrom();
+	uint64_t done = slavesLatest(doneAt);
+	uint64_t shown = slavesLatest(shownAt);
+
+	printf("{\n\t\"master\": \"%s\",\n\t\"slave\": \"%s\",\n", signSourceName(MASTER_SOURCE),
+		totals[0].source);
+	if (BIT_IS_SET(ADCSRA, ADEN)) printf("\t\"pattern\": %d,\n", pattern);
+	else printf("\t\"pattern\": null,\n");
+	printf("\t\"simulated_ms\": %.1f,\n", toMs(simCycle));
+	printf("\t\"baud\": %lu,\n", negotiated ? (unsigned long)pgm_read_dword(&baudRates[baudRate]) : 0UL);
+	if (from && done) printf("\t\"upload_ms\": %.3f,\n\t\"upload_chars\": %lu,\n", toMs(done - from),
+		(unsigned long)uploadChars);
+	else printf("\t\"upload_ms\": null,\n\t\"upload_chars\": null,\n");
+	if (from && shown) printf("\t\"pattern_shown_ms\": %.3f,\n", toMs(shown - from));
+	else printf("\t\"pattern_shown_ms\": null,\n");
+	printf("\t\"led_on_ms_per_s\": [");
+	for (uint8_t row = 0; row < SIGN_ROWS; row++)
+	{
+		printf(row ? ", [" : "[");
+		for (uint8_t col = 0; col < SIGN_WIDTH; col++) printf(col ? ", %.2f" : "%.2f", ledOnMs(row, col));
+		printf("]");
+	}
+	printf("],\n");
+	printf("\t\"garbled_chars\": %lu,\n\t\"collided_chars\": %lu,\n", (unsigned long)garbled,
+		(unsigned long)collided);
+
+	printf("\t\"isr_cycles\": \"estimated: runs times each handler's worst-case cycles per run for its usual path (host/sign_sim.h), not measured\",\n");
+	printf("\t\"devices\": [\n");
+	deviceJson("master", simCycle, simSleepCycles + simDelayCycles, simIsrCount, simIsrCycles, -1);
+	for (uint8_t slave = 0; slave < SLAVES; slave++)
+	{
+		char name[12];
+		snprintf(name, sizeof(name), "slave %u", slave + 1);
+		printf(",\n");
+		deviceJson(name, totals[slave].cycles, totals[slave].idleCycles, totals[slave].isrCount,
+			totals[slave].isrCycles, totals[slave].scans);
+	}
+	printf("\n\t]\n}\n");
+}
+
+static void printSummary(const signTotals* totals)
+{
+	uint64_t from = uploadFrom();
+	uint64_t done = slavesLatest(doneAt);
+
+	if (BIT_IS_SET(ADCSRA, ADEN))
+	{
+		char name[17];
+		patternName(pattern, name, sizeof(name));
+		printf("\nPattern %d \"%s\", %lu ms simulated\n", pattern, name, (unsigned long)toMs(simCycle));
+	}
+	else printf("\nPattern fixed in the master, %lu ms simulated\n", (unsigned long)toMs(simCycle));
+	if (negotiated)
+	{
+		printf("Link at %lu baud from %.1f ms\n", (unsigned long)pgm_read_dword(&baudRates[baudRate]),
+			toMs(negotiated));
+	}
+	else printf("Link rate not settled\n");
+
+	if (from && simCycle >= from)
+	{
+		if (BIT_IS_SET(ADCSRA, ADEN)) printf("Button pressed at %.1f ms, held %u ms\n", toMs(pressAt), PRESS_MS);
+		else printf("Upload from %.1f ms\n", toMs(from));
+		for (uint8_t slave = 0; slave < SLAVES; slave++)
+		{
+			if (!shownAt[slave]) printf("  New pattern not lit on slave %u\n", slave + 1);
+			else printf("  New pattern lit on slave %u at %.1f ms\n", slave + 1, toMs(shownAt[slave]));
+		}
+		if (done) printf("Upload: %.2f ms, %lu characters\n", toMs(done - from), (unsigned long)uploadChars);
+		// Lit on the whole sign once the later slave has it
+		if (slavesLatest(shownAt))
+		{
+			printf("%s to new pattern: %.2f ms\n", BIT_IS_SET(ADCSRA, ADEN) ? "Button" : "Upload",
+				toMs(slavesLatest(shownAt) - from));
+		}
+	}
+	else printf("Button not pressed (run longer)\n");
+
+	for (uint8_t slave = 0; slave < SLAVES; slave++)
+	{
+		printf("Slave %u: row scan %.1f frames/s, idle %.1f%%\n", slave + 1,
+			totals[slave].scans * (double)F_CPU / totals[slave].cycles,
+			100.0 * totals[slave].idleCycles / totals[slave].cycles);
+	}
+	if (slavesLatest(shownAt))
+	{
+		printf("LED on time with the new pattern, ms per s:\n");
+		for (uint8_t row = 0; row < SIGN_ROWS; row++)
+		{
+			for (uint8_t col = 0; col < SIGN_WIDTH; col++) printf(" %7.2f", ledOnMs(row, col));
+			printf("\n");
+		}
+	}
+	printf("Characters garbled by a rate mismatch: %lu, slave answers collided: %lu\n",
+		(unsigned long)garbled, (unsigned long)collided);
+	printf("Sign drawn %lu times", (unsigned long)framesDrawn);
+	if (ppmDirectory) printf(", %lu PPM frames in %s", (unsigned long)framesWritten, ppmDirectory);
+	printf("\n");
+}
+
+static void finish()
+{
+	signTotals totals[SLAVES];
+
+	slavesTotals(totals);
+	if (json) printJson(totals);
+	else printSummary(totals);
+
+	slavesStop();
+	exit(0);
+}
+
+// Potentiometer, button, and the sign drawn as time goes on
+static void scenario()
+{
+	if (!negotiated && BIT_IS_SET(TIMSK1, OCIE1A))
+	{
+		negotiated = simCycle;
+		pressAt = simCycle + MS(PRESS_AFTER_MS);
+	}
+	if (pressAt && simCycle >= pressAt && simCycle < pressAt + MS(PRESS_MS)) SET_BIT(PINC, 1);
+	else CLEAR_BIT(PINC, 1);
+
+	if (simCycle - windowStart >= MS(RENDER_MS)) render();
+	if (simCycle >= runEnd) finish();
+}
+
+// End of a step: the slaves run up to here with what the master sent, then
+// their answers come in
+static void masterClock()
+{
+	uint16_t answer = 0;
+	uint8_t answers = 0;
+
+	step.until = simCycle;
+	for (uint8_t slave = 0; slave < SLAVES; slave++)
+	{
+		if (write(slaveIn[slave], &step, sizeof(step)) != sizeof(step))
+		{
+			perror("Slave step");
+			exit(1);
+		}
+	}
+	for (uint8_t i = 0; i < step.count; i++)
+	{
+		if (!signRateMatches(step.chars[i].charCycles, simUartCharCycles())) garbled++;
+		if (uploadFrom() && step.chars[i].cycle >= uploadFrom() && !slavesLatest(doneAt)) uploadChars++;
+	}
+	step.count = 0;
+
+	for (uint8_t slave = 0; slave < SLAVES; slave++)
+	{
+		signReport report;
+		reportRead(slave, &report);
+
+		for (uint8_t i = 0; i < report.count; i++)
+		{
+			if (!signRateMatches(report.chars[i].charCycles, simUartCharCycles())) garbled++;
+			else
+			{
+				answer = report.chars[i].data;
+				answers++;
+				if (answer == LINK_POLL_DONE && uploadFrom() && simCycle >= uploadFrom() && !doneAt[slave])
+				{
+					doneAt[slave] = simCycle;
+				}
+			}
+		}
+		for (uint8_t row = 0; row < SIGN_ROWS; row++)
+		{
+			for (uint8_t col = 0; col < SIGN_COLS; col++)
+			{
+				onCycles[row][slave * SIGN_COLS + col] += report.onCycles[row][col];
+				if (slavesLatest(shownAt)) patternOnCycles[row][slave * SIGN_COLS + col] += report.onCycles[row][col];
+			}
+		}
+		if (report.shown && uploadFrom() && report.shown >= uploadFrom() && !shownAt[slave]) shownAt[slave] = report.shown;
+	}
+
+	if (answers == 1) simReceive(answer);
+	else collided += answers;
+
+	scenario();
+	simSetClockHandler(simUartCharCycles(), masterClock);
+}
+
+/* --------------- Main --------------- */
+int main(int argc, char** argv)
+{
+	const char* self = argv[0];
+
+	while (argc > 1 && argv[1][0] == '-')
+	{
+		if (!strcmp(argv[1], "-j")) json = 1;
+		else if (!strcmp(argv[1], "-v") && argc > 2)
+		{
+			vcdDirectory = argv[2];
+			argc--;
+			argv++;
+		}
+		else
+		{
+			fprintf(stderr, "sign_sim [-j] [-v VCD directory] [pattern] [run ms] [PPM directory]\n");
+			return 1;
+		}
+		argc--;
+		argv++;
+	}
+	if (argc > 1) pattern = strtoul(argv[1], NULL, 0);
+	if (argc > 2) runEnd = MS(strtoul(argv[2], NULL, 0));
+	if (argc > 3) ppmDirectory = argv[3];
+	if (pattern >= numMtrxPatterns)
+	{
+		fprintf(stderr, "Patterns 0 to %d\n", numMtrxPatterns - 1);
+		return 1;
+	}
+
+	slavesStart(self);
+	if (vcdDirectory)
+	{
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/master.vcd", vcdDirectory);
+		if (!simVcdOpen(path))
+		{
+			perror(path);
+			return 1;
+		}
+		atexit(simVcdClose);
+	}
+	// Potentiometer in the middle of the pattern's range
+	simSetAdc(0, (uint16_t)((pattern + 0.5) * 1023 / numMtrxPatterns));
+	signMasterIsrCycles();
+	simSetTxHandler(masterSent);
+	simSetClockHandler(simUartCharCycles(), masterClock);
+
+	if (!json) printf("Sign at every change (brightness %s, a row lit all the time -> %c)\n", ramp, ramp[RAMP_LEVELS - 1]);
+	return device1_main();
+}
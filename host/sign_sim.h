@@ -0,0 +1,90 @@
+// Messages between sign_sim (the master) and each sign_slave process
+// The devices run in lockstep, one character time of the master per step:
+// the master sends each slave what its TX pin put on the wire during the
+// step, the slave runs up to the end of the step taking those characters in
+// as they arrive, then answers with what its own TX pin put out and how long
+// each of its LEDs was lit. A last step of SIGN_STEP_END characters asks the
+// slave for its totals, then it stops.
+#ifndef HOST_SIGN_SIM_H
+#define HOST_SIGN_SIM_H
+
+#include <stdint.h>
+#include <string.h>
+#include "sim_avr.h"
+
+#define SIGN_ROWS			3 // LEDs of one slave
+#define SIGN_COLS			3
+#define SIGN_STEP_CHARS		4 // Most characters passed in one step, either way
+#define SIGN_STEP_END		0xFF // Character count of the last step
+#define SIGN_RATE_PERCENT	2 // Furthest off its own character time a receiver still reads right
+
+// One character on a wire
+typedef struct {
+	uint64_t cycle;			// Its stop bit is out
+	uint32_t charCycles;	// Character time of the sender
+	uint16_t data;			// 9 bits
+} signChar;
+
+// Master -> slave
+typedef struct {
+	uint64_t until;			// Run up to this cycle
+	uint8_t count;
+	signChar chars[SIGN_STEP_CHARS];	// From the master's TX, in order
+} signStep;
+
+// Slave -> master, at the end of each step
+typedef struct {
+	uint8_t count;
+	signChar chars[SIGN_STEP_CHARS];	// From the slave's TX
+	uint32_t onCycles[SIGN_ROWS][SIGN_COLS];	// Each LED lit during the step
+	uint64_t shown;			// First row lit after a restart sync, in this step (0 -> none)
+} signReport;
+
+// Slave -> master, after the last step
+typedef struct {
+	uint64_t cycles;
+	uint64_t idleCycles;	// Asleep or in a busy wait
+	uint32_t isrCount[SIM_NUM_VECTORS];
+	uint16_t isrCycles[SIM_NUM_VECTORS];	// Estimate charged per run
+	uint32_t scans;			// Full frames of the row scan
+	char source[32];		// Firmware file
+} signTotals;
+
+// File name of a firmware source path
+static inline const char* signSourceName(const char* path)
+{
+	const char* slash = strrchr(path, '/');
+	return slash ? slash + 1 : path;
+}
+
+// Cycles charged for each run of an interrupt handler (simIsrCycles), in
+// place of the simulator's flat default: worst-case estimates for avr-gcc -O2
+// code of the usual path, not measured. The slave's are host/bench_rx.c's
+// (receive, frame step) and host/bench_bam.c's (row scan); the master has
+// no bench of its own and is estimated the same way.
+static inline void signMasterIsrCycles()
+{
+	simIsrCycles[SIM_USART_UDRE] = 90;		// Next character of the TX ring, its 9th bit
+	simIsrCycles[SIM_USART_RX] = 60;		// A slave's answer
+	simIsrCycles[SIM_TIMER1_COMPA] = 800;	// Frame sync out, frameTicks() division
+	simIsrCycles[SIM_TIMER0_OVF] = 80;		// ADC start, switch debounce
+	simIsrCycles[SIM_TIMER0_COMPA] = 200;	// LCD entry: two nibbles, two enable pulses each
+	simIsrCycles[SIM_ADC] = 100;			// Pattern select, 32 bit multiply
+}
+
+static inline void signSlaveIsrCycles()
+{
+	simIsrCycles[SIM_USART_RX] = 70;		// Queue a byte (a frame sync latch: 130)
+	simIsrCycles[SIM_TIMER1_COMPA] = 300;	// Frame step (after a sync: 600)
+	simIsrCycles[SIM_TIMER0_COMPA] = 110;	// Row scan slice
+	simIsrCycles[SIM_TIMER0_COMPB] = 35;	// Row off
+}
+
+// A character sent at another rate comes in garbled
+static inline int signRateMatches(uint32_t sent, uint32_t own)
+{
+	uint32_t off = sent > own ? sent - own : own - sent;
+	return off * 100 <= own * SIGN_RATE_PERCENT;
+}
+
+#endif
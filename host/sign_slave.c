@@ -0,0 +1,167 @@
+// One slave (device2.c, unmodified) of the full-sign simulation, started by
+// sign_sim: steps come in on stdin and reports go out on stdout (sign_sim.h).
+// Characters from the master are delivered at the cycle their stop bit left
+// its TX pin, unless they were sent at another rate. The LEDs are read off
+// the row (PORTC) and column (PORTD) pins at every change.
+//   sign_slave <address> [VCD directory]
+//
+// Build: gcc -O2 -fgnu89-inline -Ihost -o sign_slave host/sign_slave.c host/sim_avr.c
+// (-DSLAVE_SOURCE='"../device2_final.c"' for another firmware source)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sign_sim.h"
+
+static uint8_t slaveAddress = 1;
+
+#ifndef SLAVE_SOURCE
+#define SLAVE_SOURCE	"../device2.c"
+#endif
+
+#define SLAVE_ADDRESS	slaveAddress
+#define main device2_main
+#include SLAVE_SOURCE
+#undef main
+
+static signStep step;
+static uint8_t delivered = 0; // Characters of the step taken in
+static signReport report;
+
+/* --------------- LEDs --------------- */
+static uint8_t litRows = 0; // Row pins driven low
+static uint8_t litCols = 0; // Column pins driven high
+static uint64_t litSince = 0;
+static uint8_t syncNext = 0; // Next character is the byte of a frame sync
+static uint8_t restartDue = 0; // Restart sync in, new pattern not lit yet
+
+// On time of each lit LED up to now
+static void ledsCount()
+{
+	for (uint8_t row = 0; row < SIGN_ROWS; row++)
+	{
+		if (!(litRows & rowBits[row])) continue;
+		for (uint8_t col = 0; col < SIGN_COLS; col++)
+		{
+			if (litCols & colBits[col]) report.onCycles[row][col] += simCycle - litSince;
+		}
+	}
+	litSince = simCycle;
+}
+
+static void slavePins()
+{
+	ledsCount();
+	litRows = ROW_DDR & ~ROW_PORT & ROW_MASK;
+	litCols = COL_DDR & COL_PORT & COL_MASK;
+
+	if (restartDue && litRows)
+	{
+		restartDue = 0;
+		report.shown = simCycle;
+	}
+}
+
+/* --------------- Wire --------------- */
+static void slaveSent(uint16_t data)
+{
+	if (report.count == SIGN_STEP_CHARS) return;
+	report.chars[report.count].cycle = simCycle;
+	report.chars[report.count].charCycles = simUartCharCycles();
+	report.chars[report.count].data = data;
+	report.count++;
+}
+
+static void deliver(const signChar* sent)
+{
+	if (!signRateMatches(sent->charCycles, simUartCharCycles())) return;
+
+	// Restart sync: the pattern it restarts shows from the next row lit
+	if (syncNext && !(sent->data & LINK_ADDRESS_BIT) && (sent->data & SYNC_RESTART)) restartDue = 1;
+	syncNext = sent->data == (LINK_ADDRESS_BIT | LINK_SYNC);
+
+	simReceive(sent->data);
+}
+
+// Totals of the run, then the process ends
+static void totalsWrite()
+{
+	signTotals totals;
+
+	memset(&totals, 0, sizeof(totals));
+	totals.cycles = simCycle;
+	totals.idleCycles = simSleepCycles + simDelayCycles;
+	for (uint8_t vector = 0; vector < SIM_NUM_VECTORS; vector++)
+	{
+		totals.isrCount[vector] = simIsrCount[vector];
+		totals.isrCycles[vector] = simIsrCycles[vector];
+	}
+	// A slice interrupt per BAM bit of each row, lit or not
+	totals.scans = simIsrCount[SIM_TIMER0_COMPA] / (BAM_BITS * rowSpan);
+	snprintf(totals.source, sizeof(totals.source), "%s", signSourceName(SLAVE_SOURCE));
+	exit(write(STDOUT_FILENO, &totals, sizeof(totals)) != sizeof(totals));
+}
+
+// Next step from the master, ends the process once it has stopped
+static void stepRead()
+{
+	uint8_t* at = (uint8_t*)&step;
+	size_t left = sizeof(step);
+
+	while (left)
+	{
+		ssize_t got = read(STDIN_FILENO, at, left);
+		if (got <= 0) exit(0);
+		at += got;
+		left -= got;
+	}
+	if (step.count == SIGN_STEP_END) totalsWrite();
+	delivered = 0;
+}
+
+static void reportWrite()
+{
+	ledsCount();
+	if (write(STDOUT_FILENO, &report, sizeof(report)) != sizeof(report)) exit(1);
+	memset(&report, 0, sizeof(report));
+}
+
+// Each character of the step as it arrives, then the report at its end
+static void slaveClock()
+{
+	while (delivered < step.count && step.chars[delivered].cycle <= simCycle)
+	{
+		deliver(&step.chars[delivered++]);
+	}
+	if (simCycle >= step.until)
+	{
+		reportWrite();
+		stepRead();
+	}
+
+	uint64_t next = delivered < step.count ? step.chars[delivered].cycle : step.until;
+	simSetClockHandler(next > simCycle ? next - simCycle : 1, slaveClock);
+}
+
+/* --------------- Main --------------- */
+int main(int argc, char** argv)
+{
+	if (argc > 1) slaveAddress = strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+	{
+		// Trace into a directory, written out when the process ends
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/slave%u.vcd", argv[2], slaveAddress);
+		if (!simVcdOpen(path)) return 1;
+		atexit(simVcdClose);
+	}
+
+	signSlaveIsrCycles();
+	simSetTxHandler(slaveSent);
+	simSetPinHandler(slavePins);
+	stepRead();
+	simSetClockHandler(step.until, slaveClock);
+
+	return device2_main();
+}
@@ -0,0 +1,872 @@
+// Simulated ATmega328P peripherals for host builds of the firmware
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "avr/io.h"
+#include "sim_avr.h"
+
+// Bit operations
+#define SET_BIT(reg, pin)			(reg) |= (1 << (pin))
+#define CLEAR_BIT(reg, pin)			(reg) &= ~(1 << (pin))
+#define BIT_IS_SET(reg, pin)		((((reg) >> (pin)) & 1) == 1)
+
+/* --------------- Register file --------------- */
+volatile uint8_t PINB, simDDRB, simPORTB;
+volatile uint8_t PINC, simDDRC, simPORTC;
+volatile uint8_t PIND, simDDRD, simPORTD;
+volatile uint8_t SREG, SMCR, MCUCR;
+volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B, TIMSK0, TIFR0;
+volatile uint8_t TCCR1A, TCCR1B, TCCR1C, TIMSK1, TIFR1;
+volatile uint16_t TCNT1, OCR1A, OCR1B, ICR1;
+volatile uint8_t TCCR2A, TCCR2B, TCNT2, OCR2A, OCR2B, TIMSK2, TIFR2;
+volatile uint8_t UCSR0A = (1 << UDRE0);
+volatile uint8_t UCSR0B;
+volatile uint8_t UCSR0C = (1 << UCSZ01) | (1 << UCSZ00);
+volatile uint16_t UBRR0;
+volatile uint16_t UDR0 = SIM_UDR_OWNED;
+volatile uint8_t ADMUX, ADCSRA, ADCSRB, DIDR0;
+volatile uint16_t ADC;
+
+/* --------------- Interrupt vectors --------------- */
+// Handlers the firmware defines with ISR(); weak so unused ones stay NULL
+#define VECTOR(name)	void name(void) __attribute__((weak));
+VECTOR(TIMER2_COMPA_vect)
+VECTOR(TIMER2_COMPB_vect)
+VECTOR(TIMER2_OVF_vect)
+VECTOR(TIMER1_COMPA_vect)
+VECTOR(TIMER1_COMPB_vect)
+VECTOR(TIMER1_OVF_vect)
+VECTOR(TIMER0_COMPA_vect)
+VECTOR(TIMER0_COMPB_vect)
+VECTOR(TIMER0_OVF_vect)
+VECTOR(USART_RX_vect)
+VECTOR(USART_UDRE_vect)
+VECTOR(USART_TX_vect)
+VECTOR(ADC_vect)
+#undef VECTOR
+
+static void (*const vectorTable[SIM_NUM_VECTORS])(void) = {
+	TIMER2_COMPA_vect, TIMER2_COMPB_vect, TIMER2_OVF_vect,
+	TIMER1_COMPA_vect, TIMER1_COMPB_vect, TIMER1_OVF_vect,
+	TIMER0_COMPA_vect, TIMER0_COMPB_vect, TIMER0_OVF_vect,
+	USART_RX_vect, USART_UDRE_vect, USART_TX_vect,
+	ADC_vect
+};
+
+const char* const simVectorNames[SIM_NUM_VECTORS] = {
+	"TIMER2_COMPA", "TIMER2_COMPB", "TIMER2_OVF",
+	"TIMER1_COMPA", "TIMER1_COMPB", "TIMER1_OVF",
+	"TIMER0_COMPA", "TIMER0_COMPB", "TIMER0_OVF",
+	"USART_RX", "USART_UDRE", "USART_TX",
+	"ADC"
+};
+
+uint64_t simCycle = 0;
+uint64_t simSleepCycles = 0;
+uint64_t simDelayCycles = 0;
+uint32_t simIsrCount[SIM_NUM_VECTORS];
+// 4 cycles response + push/pop of SREG and a few registers + 4 cycles reti
+uint16_t simIsrCycles[SIM_NUM_VECTORS] = {
+	40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40
+};
+
+/* --------------- Trace --------------- */
+// Value changes are collected as they happen (USART frames once their stop
+// bit is in, back to their start bit) and written out in time order on close
+#define VCD_PINS			24 // PB0-PB7, PC0-PC7, PD0-PD7
+#define VCD_TXD				VCD_PINS // USART lines, bit by bit
+#define VCD_RXD				(VCD_PINS + 1)
+#define VCD_TX				(VCD_PINS + 2) // Character on each line, as a 9 bit bus
+#define VCD_RX				(VCD_PINS + 3)
+#define VCD_ISR				(VCD_PINS + 4) // Interrupt handler running, one per vector
+#define VCD_SIGNALS			(VCD_ISR + SIM_NUM_VECTORS)
+#define VCD_Z				0xFFFF // Pin not driven, line idle
+
+typedef struct {
+	uint64_t cycle;
+	uint32_t order;		// Changes at one cycle keep their order
+	uint16_t signal;
+	uint16_t value;
+} simVcdChange;
+
+static FILE* vcdFile = NULL;
+static simVcdChange* vcdChanges = NULL;
+static uint32_t vcdCount = 0;
+static uint32_t vcdSize = 0;
+static uint64_t vcdStart = 0;
+static uint16_t vcdInitial[VCD_SIGNALS];
+static uint16_t vcdPinLevel[VCD_PINS];
+static uint8_t vcdTraced[VCD_SIGNALS];	// Declared in the header (vectors taken, every other signal)
+static uint64_t vcdPinCycle = 0;		// Cycle the last pin change was traced at
+
+static void vcdChange(uint64_t cycle, uint16_t signal, uint16_t value)
+{
+	if (!vcdFile) return;
+	if (vcdCount == vcdSize)
+	{
+		vcdSize = vcdSize ? 2 * vcdSize : 4096;
+		vcdChanges = realloc(vcdChanges, vcdSize * sizeof(simVcdChange));
+		if (!vcdChanges) abort();
+	}
+	vcdChanges[vcdCount].cycle = cycle;
+	vcdChanges[vcdCount].order = vcdCount;
+	vcdChanges[vcdCount].signal = signal;
+	vcdChanges[vcdCount].value = value;
+	vcdCount++;
+}
+
+// Level of each port pin: its PORT bit if it is an output, otherwise undriven
+// Changes are traced SIM_PIN_WRITE_CYCLES after the last ones at the
+// earliest: the clock stands still while a handler runs, and this keeps the
+// order of its writes
+static void vcdPins(uint64_t cycle)
+{
+	const volatile uint8_t* ports[3] = {&simPORTB, &simPORTC, &simPORTD};
+	const volatile uint8_t* ddrs[3] = {&simDDRB, &simDDRC, &simDDRD};
+	uint8_t changed = 0;
+
+	if (cycle < vcdPinCycle + SIM_PIN_WRITE_CYCLES) cycle = vcdPinCycle + SIM_PIN_WRITE_CYCLES;
+	for (uint8_t pin = 0; pin < VCD_PINS; pin++)
+	{
+		uint8_t bit = pin & 7;
+		uint16_t level = BIT_IS_SET(*ddrs[pin >> 3], bit) ? BIT_IS_SET(*ports[pin >> 3], bit) : VCD_Z;
+		if (level == vcdPinLevel[pin]) continue;
+		vcdPinLevel[pin] = level;
+		vcdChange(cycle, pin, level);
+		changed = 1;
+	}
+	if (changed) vcdPinCycle = cycle;
+}
+
+// Every firmware access to PORTx or DDRx: traces what the one before it wrote
+volatile uint8_t* simPinAccess(volatile uint8_t* reg)
+{
+	if (vcdFile) vcdPins(simCycle);
+	return reg;
+}
+
+// One character on a USART line, its stop bit ending now: start bit (low),
+// data bits from the least significant, stop bit (high)
+static void vcdFrame(uint16_t line, uint16_t bus, uint16_t data, uint8_t dataBits, uint32_t charCycles)
+{
+	uint8_t bits = 2 + dataBits;
+	uint64_t start = simCycle - charCycles;
+	uint8_t level = 1;
+
+	for (uint8_t bit = 0; bit < bits; bit++)
+	{
+		uint8_t next = bit == 0 ? 0 : bit > dataBits ? 1 : (data >> (bit - 1)) & 1;
+		if (next != level) vcdChange(start + (uint64_t)charCycles * bit / bits, line, next);
+		level = next;
+	}
+	vcdChange(start, bus, data);
+	vcdChange(simCycle, bus, VCD_Z);
+}
+
+int simVcdOpen(const char* path)
+{
+	vcdFile = fopen(path, "w");
+	if (!vcdFile) return 0;
+
+	vcdCount = 0;
+	vcdStart = simCycle;
+	for (uint16_t signal = 0; signal < VCD_SIGNALS; signal++)
+	{
+		vcdInitial[signal] = signal < VCD_PINS ? VCD_Z : signal < VCD_TX ? 1 : signal < VCD_ISR ? VCD_Z : 0;
+		vcdTraced[signal] = signal < VCD_ISR;
+	}
+	for (uint8_t pin = 0; pin < VCD_PINS; pin++) vcdPinLevel[pin] = VCD_Z;
+	vcdPinCycle = 0;
+	vcdPins(simCycle);
+	for (uint32_t i = 0; i < vcdCount; i++) vcdInitial[vcdChanges[i].signal] = vcdChanges[i].value;
+	vcdCount = 0;
+	return 1;
+}
+
+static int vcdCompare(const void* a, const void* b)
+{
+	const simVcdChange* x = a;
+	const simVcdChange* y = b;
+	if (x->cycle != y->cycle) return x->cycle < y->cycle ? -1 : 1;
+	return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static void vcdValue(uint16_t signal, uint16_t value)
+{
+	char id = '!' + signal;
+
+	if (signal == VCD_TX || signal == VCD_RX)
+	{
+		if (value == VCD_Z) fprintf(vcdFile, "bz %c\n", id);
+		else
+		{
+			fputc('b', vcdFile);
+			for (int8_t bit = 8; bit >= 0; bit--) fputc('0' + ((value >> bit) & 1), vcdFile);
+			fprintf(vcdFile, " %c\n", id);
+		}
+	}
+	else fprintf(vcdFile, "%c%c\n", value == VCD_Z ? 'z' : '0' + value, id);
+}
+
+void simVcdClose()
+{
+	static const char* const lines[4] = {"TXD", "RXD", "tx_data", "rx_data"};
+	uint64_t psPerCycle = 1000000000000ULL / F_CPU;
+	uint64_t written;
+
+	if (!vcdFile) return;
+	qsort(vcdChanges, vcdCount, sizeof(simVcdChange), vcdCompare);
+
+	fprintf(vcdFile, "$comment Simulated ATmega328P, one CPU cycle = %llu ps $end\n", (unsigned long long)psPerCycle);
+	fprintf(vcdFile, "$timescale 1ps $end\n");
+	fprintf(vcdFile, "$scope module pins $end\n");
+	for (uint8_t pin = 0; pin < VCD_PINS; pin++)
+	{
+		fprintf(vcdFile, "$var wire 1 %c P%c%u $end\n", '!' + pin, 'B' + (pin >> 3), pin & 7);
+	}
+	fprintf(vcdFile, "$upscope $end\n$scope module usart $end\n");
+	for (uint8_t line = 0; line < 4; line++)
+	{
+		fprintf(vcdFile, "$var wire %u %c %s $end\n", line < 2 ? 1 : 9, '!' + VCD_TXD + line, lines[line]);
+	}
+	fprintf(vcdFile, "$upscope $end\n$scope module isr $end\n");
+	for (uint8_t vector = 0; vector < SIM_NUM_VECTORS; vector++)
+	{
+		if (!vcdTraced[VCD_ISR + vector]) continue;
+		fprintf(vcdFile, "$var wire 1 %c %s $end\n", '!' + VCD_ISR + vector, simVectorNames[vector]);
+	}
+	fprintf(vcdFile, "$upscope $end\n$enddefinitions $end\n");
+
+	fprintf(vcdFile, "#%llu\n$dumpvars\n", (unsigned long long)(vcdStart * psPerCycle));
+	for (uint16_t signal = 0; signal < VCD_SIGNALS; signal++)
+	{
+		if (vcdTraced[signal]) vcdValue(signal, vcdInitial[signal]);
+	}
+	fprintf(vcdFile, "$end\n");
+
+	written = vcdStart;
+	for (uint32_t i = 0; i < vcdCount; i++)
+	{
+		// USART frames still on the line when tracing started are cut off
+		if (vcdChanges[i].cycle < vcdStart) continue;
+		if (vcdChanges[i].cycle != written)
+		{
+			written = vcdChanges[i].cycle;
+			fprintf(vcdFile, "#%llu\n", (unsigned long long)(written * psPerCycle));
+		}
+		vcdValue(vcdChanges[i].signal, vcdChanges[i].value);
+	}
+
+	fclose(vcdFile);
+	vcdFile = NULL;
+	free(vcdChanges);
+	vcdChanges = NULL;
+	vcdSize = 0;
+	vcdCount = 0;
+}
+
+/* --------------- USART0 --------------- */
+static void (*txHandler)(uint16_t data) = NULL;
+
+static uint8_t txShiftBusy = 0;		// Character in the transmit shift register
+static uint16_t txShiftData = 0;
+static uint32_t txShiftLeft = 0;	// Cycles until its stop bit is out
+static uint8_t txBufferFull = 0;	// Character waiting in UDR0
+static uint16_t txBufferData = 0;
+
+static uint16_t rxFifo[2];			// Two level receive FIFO
+static uint8_t rxCount = 0;
+static uint16_t rxLast = 0;
+
+static uint16_t (*rxSource)(void) = NULL;
+static uint32_t rxSourceLeft = 0;	// Cycles until its next stop bit
+
+static uint8_t uartDataBits()
+{
+	uint8_t size = ((UCSR0C >> UCSZ00) & 3) | (BIT_IS_SET(UCSR0B, UCSZ02) << 2);
+	return size == 7 ? 9 : size + 5;
+}
+
+uint32_t simUartCharCycles()
+{
+	// Start bit + data + optional parity + stop bit(s)
+	uint32_t bits = 1 + uartDataBits() + (BIT_IS_SET(UCSR0C, UPM01) ? 1 : 0) +
+		(BIT_IS_SET(UCSR0C, USBS0) ? 2 : 1);
+	uint32_t cyclesPerBit = (BIT_IS_SET(UCSR0A, U2X0) ? 8 : 16) * ((uint32_t)UBRR0 + 1);
+	return bits * cyclesPerBit;
+}
+
+int simUartTxIdle()
+{
+	return !txShiftBusy && !txBufferFull && (UDR0 & SIM_UDR_OWNED);
+}
+
+// Status bits are owned by the hardware: rebuild them after firmware writes
+static void uartStatus()
+{
+	uint8_t writable = (1 << U2X0) | (1 << MPCM0) | (1 << TXC0) | (1 << DOR0);
+	UCSR0A = (UCSR0A & writable) |
+		(txBufferFull ? 0 : (1 << UDRE0)) |
+		(rxCount ? (1 << RXC0) : 0);
+}
+
+static void uartLoadShift(uint16_t data)
+{
+	txShiftBusy = 1;
+	txShiftData = data;
+	txShiftLeft = simUartCharCycles();
+}
+
+// Pick up a character the firmware has written to UDR0
+static void uartSync()
+{
+	if (!(UDR0 & SIM_UDR_OWNED))
+	{
+		uint16_t data = UDR0 & 0xFF;
+		if (uartDataBits() == 9 && BIT_IS_SET(UCSR0B, TXB80)) data |= 0x100;
+		UDR0 = SIM_UDR_OWNED | rxLast;
+
+		if (BIT_IS_SET(UCSR0B, TXEN0))
+		{
+			if (!txShiftBusy) uartLoadShift(data);
+			else if (!txBufferFull)
+			{
+				txBufferFull = 1;
+				txBufferData = data;
+			}
+			// else: written while UDRE0 was clear -> lost, as on hardware
+		}
+	}
+	uartStatus();
+}
+
+static void uartAdvance(uint64_t cycles)
+{
+	if (!txShiftBusy) return;
+
+	if (cycles < txShiftLeft)
+	{
+		txShiftLeft -= cycles;
+		return;
+	}
+
+	// Stop bit out
+	txShiftBusy = 0;
+	vcdFrame(VCD_TXD, VCD_TX, txShiftData, uartDataBits(), simUartCharCycles());
+	if (txHandler) txHandler(txShiftData);
+	if (txBufferFull)
+	{
+		txBufferFull = 0;
+		uartLoadShift(txBufferData);
+	}
+	else
+	{
+		SET_BIT(UCSR0A, TXC0);
+	}
+	uartStatus();
+}
+
+static void uartPresentRx()
+{
+	rxLast = rxFifo[0];
+	UDR0 = SIM_UDR_OWNED | (rxLast & 0xFF);
+	if (rxLast & 0x100) SET_BIT(UCSR0B, RXB80);
+	else CLEAR_BIT(UCSR0B, RXB80);
+}
+
+// The RX interrupt handler has read UDR0 -> drop the character from the FIFO
+static void uartConsumeRx()
+{
+	if (!rxCount) return;
+	CLEAR_BIT(UCSR0A, DOR0);
+	rxFifo[0] = rxFifo[1];
+	rxCount--;
+	if (rxCount) uartPresentRx();
+	uartStatus();
+}
+
+void simSetTxHandler(void (*handler)(uint16_t data))
+{
+	txHandler = handler;
+}
+
+void simSetRxSource(uint16_t (*source)(void))
+{
+	rxSource = source;
+	rxSourceLeft = simUartCharCycles();
+}
+
+// Next character from the RX source, once its time on the wire is up
+static void uartRxAdvance(uint64_t cycles)
+{
+	if (!rxSource) return;
+
+	if (cycles < rxSourceLeft)
+	{
+		rxSourceLeft -= cycles;
+		return;
+	}
+	rxSourceLeft = simUartCharCycles();
+	simReceive(rxSource());
+}
+
+void simReceive(uint16_t data)
+{
+	vcdFrame(VCD_RXD, VCD_RX, data, uartDataBits(), simUartCharCycles());
+	if (!BIT_IS_SET(UCSR0B, RXEN0)) return;
+	// Multi-processor mode: frames without the address bit (9th bit) are
+	// dropped by the receiver, no RXC0 and no interrupt
+	if (BIT_IS_SET(UCSR0A, MPCM0) && !(data & 0x100)) return;
+
+	if (rxCount == 2)
+	{
+		// Receive buffer full -> data overrun
+		SET_BIT(UCSR0A, DOR0);
+		return;
+	}
+	rxFifo[rxCount++] = data;
+	if (rxCount == 1) uartPresentRx();
+	uartStatus();
+}
+
+/* --------------- Timers --------------- */
+// Counter state gathered from the registers of one timer
+typedef struct {
+	uint16_t count;
+	uint16_t top;		// Counter wraps to 0 after this value
+	uint16_t max;		// 0xFF or 0xFFFF
+	uint16_t ocra;
+	uint16_t ocrb;
+	uint16_t prescale;	// 0 -> stopped
+	uint8_t ctc;		// Clear on compare: no overflow flag at TOP
+	uint8_t flags;		// TOV, OCFA, OCFB raised by this step
+} simTimer;
+
+#define NO_EVENT	0xFFFFFFFFUL
+
+static uint16_t prescaler(uint8_t clockSelect, uint8_t timer2)
+{
+	static const uint16_t prescale01[8] = {0, 1, 8, 64, 256, 1024, 0, 0}; // 6, 7: external clock
+	static const uint16_t prescale2[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+	return timer2 ? prescale2[clockSelect & 7] : prescale01[clockSelect & 7];
+}
+
+// Mode of an 8 bit timer from its WGM bits
+static void timer8Mode(simTimer* t, uint8_t tccra, uint8_t tccrb)
+{
+	uint8_t wgm = (tccra & 3) | ((tccrb >> 1) & 4);
+	t->max = 0xFF;
+	t->top = 0xFF;
+	t->ctc = 0;
+	if (wgm == 2)
+	{
+		t->top = t->ocra;
+		t->ctc = 1;
+	}
+	else if (wgm == 7)
+	{
+		t->top = t->ocra;
+	}
+}
+
+static void timerLoad(uint8_t n, simTimer* t)
+{
+	t->flags = 0;
+	switch (n)
+	{
+		case 0:
+			t->count = TCNT0; t->ocra = OCR0A; t->ocrb = OCR0B;
+			t->prescale = prescaler(TCCR0B, 0);
+			timer8Mode(t, TCCR0A, TCCR0B);
+			break;
+		case 1:
+		{
+			uint8_t wgm = (TCCR1A & 3) | ((TCCR1B >> 1) & 0xC);
+			t->count = TCNT1; t->ocra = OCR1A; t->ocrb = OCR1B;
+			t->prescale = prescaler(TCCR1B, 0);
+			t->max = 0xFFFF;
+			t->top = 0xFFFF;
+			t->ctc = 0;
+			if (wgm == 4) { t->top = OCR1A; t->ctc = 1; }
+			else if (wgm == 12) { t->top = ICR1; t->ctc = 1; }
+			else if (wgm == 14) { t->top = ICR1; }
+			else if (wgm == 15) { t->top = OCR1A; }
+			break;
+		}
+		default:
+			t->count = TCNT2; t->ocra = OCR2A; t->ocrb = OCR2B;
+			t->prescale = prescaler(TCCR2B, 1);
+			timer8Mode(t, TCCR2A, TCCR2B);
+			break;
+	}
+}
+
+static void timerStore(uint8_t n, simTimer* t)
+{
+	switch (n)
+	{
+		case 0: TCNT0 = t->count; TIFR0 |= t->flags; break;
+		case 1: TCNT1 = t->count; TIFR1 |= t->flags; break;
+		default: TCNT2 = t->count; TIFR2 |= t->flags; break;
+	}
+}
+
+// Timer ticks from the current count until the counter next equals value
+static uint32_t ticksUntil(simTimer* t, uint16_t value)
+{
+	if (t->count > t->top)
+	{
+		// Written past TOP -> runs on to MAX before wrapping
+		if (value > t->count) return value - t->count;
+		if (value > t->top) return NO_EVENT;
+		return (uint32_t)t->max - t->count + 1 + value;
+	}
+	if (value > t->top) return NO_EVENT;
+	uint32_t period = (uint32_t)t->top + 1;
+	uint32_t distance = (value + period - t->count) % period;
+	return distance ? distance : period;
+}
+
+// Timer ticks until the counter moves off value, which is when the hardware
+// raises a compare flag (CTC clears to BOTTOM on that same tick)
+static uint32_t ticksLeaving(simTimer* t, uint16_t value)
+{
+	if (t->count == value) return 1;
+	uint32_t ticks = ticksUntil(t, value);
+	return ticks == NO_EVENT ? NO_EVENT : ticks + 1;
+}
+
+// Timer ticks until the next flag is raised
+static uint32_t timerTicksToEvent(simTimer* t)
+{
+	uint32_t ticks = ticksLeaving(t, t->ocra);
+	uint32_t toB = ticksLeaving(t, t->ocrb);
+	if (toB < ticks) ticks = toB;
+	// Wrap: TOP -> BOTTOM
+	uint32_t toWrap = (t->count > t->top ? t->max : t->top) - t->count + 1;
+	if (toWrap < ticks) ticks = toWrap;
+	return ticks;
+}
+
+// Count a number of timer ticks, raising TOV/OCFA/OCFB as the counter passes them
+static void timerTicks(simTimer* t, uint32_t ticks)
+{
+	while (ticks)
+	{
+		uint32_t toEvent = timerTicksToEvent(t);
+		if (ticks < toEvent)
+		{
+			t->count += ticks;
+			return;
+		}
+
+		// Up to the tick that raises the flag(s)
+		ticks -= toEvent;
+		t->count += toEvent - 1;
+		uint16_t from = t->count;
+		uint16_t wrapAt = t->count > t->top ? t->max : t->top;
+		if (from == wrapAt)
+		{
+			// TOP (or MAX) -> BOTTOM
+			if (!t->ctc || wrapAt == t->max) t->flags |= (1 << TOV0);
+			t->count = 0;
+		}
+		else
+		{
+			t->count++;
+		}
+		if (from == t->ocra) t->flags |= (1 << OCF0A);
+		if (from == t->ocrb) t->flags |= (1 << OCF0B);
+	}
+}
+
+// Timer ticks between two points in time
+static uint64_t ticksBetween(uint64_t from, uint64_t to, uint16_t prescale)
+{
+	return to / prescale - from / prescale;
+}
+
+static uint64_t timerCyclesToEvent(uint8_t n)
+{
+	simTimer t;
+	timerLoad(n, &t);
+	if (!t.prescale) return NO_EVENT;
+
+	// First tick, then whole prescaler periods
+	uint64_t ticks = timerTicksToEvent(&t);
+	return (t.prescale - simCycle % t.prescale) + (ticks - 1) * t.prescale;
+}
+
+static void timerAdvance(uint8_t n, uint64_t from, uint64_t to)
+{
+	simTimer t;
+	timerLoad(n, &t);
+	if (!t.prescale) return;
+
+	uint64_t ticks = ticksBetween(from, to, t.prescale);
+	if (!ticks) return;
+	timerTicks(&t, ticks);
+	timerStore(n, &t);
+}
+
+/* --------------- ADC --------------- */
+static uint16_t adcInputs[8];		// Voltage on each channel, as a 10 bit result
+static uint8_t adcConverting = 0;
+static uint32_t adcLeft = 0;		// Cycles until the result is in
+
+void simSetAdc(uint8_t channel, uint16_t value)
+{
+	adcInputs[channel & 7] = value & 0x3FF;
+}
+
+// Start a conversion the firmware has asked for with ADSC: 13 ADC clocks
+static void adcSync()
+{
+	if (adcConverting || !BIT_IS_SET(ADCSRA, ADEN) || !BIT_IS_SET(ADCSRA, ADSC)) return;
+
+	uint8_t prescaler = ADCSRA & 7;
+	adcConverting = 1;
+	adcLeft = 13 * (prescaler <= 1 ? 2 : 1 << prescaler);
+}
+
+static void adcAdvance(uint64_t cycles)
+{
+	if (!adcConverting) return;
+
+	if (cycles < adcLeft)
+	{
+		adcLeft -= cycles;
+		return;
+	}
+	adcConverting = 0;
+	ADC = adcInputs[ADMUX & 7];
+	CLEAR_BIT(ADCSRA, ADSC);
+	SET_BIT(ADCSRA, ADIF);
+}
+
+/* --------------- Pins --------------- */
+static void (*pinHandler)(void) = NULL;
+static uint8_t pinState[6];
+
+void simSetPinHandler(void (*handler)(void))
+{
+	pinHandler = handler;
+}
+
+// Report port/direction writes since the last look
+static void pinSync()
+{
+	uint8_t now[6] = {simPORTB, simPORTC, simPORTD, simDDRB, simDDRC, simDDRD};
+	for (uint8_t i = 0; i < 6; i++)
+	{
+		if (now[i] != pinState[i])
+		{
+			for (i = 0; i < 6; i++) pinState[i] = now[i];
+			vcdPins(simCycle);
+			if (pinHandler) pinHandler();
+			return;
+		}
+	}
+}
+
+/* --------------- Interrupt dispatch --------------- */
+static uint8_t inDispatch = 0;
+static uint32_t isrTotal = 0;
+
+static int pending(uint8_t vector)
+{
+	switch (vector)
+	{
+		case SIM_TIMER2_COMPA:
+			return TIMSK2 & TIFR2 & (1 << OCF2A);
+		case SIM_TIMER2_COMPB:
+			return TIMSK2 & TIFR2 & (1 << OCF2B);
+		case SIM_TIMER2_OVF:
+			return TIMSK2 & TIFR2 & (1 << TOV2);
+		case SIM_TIMER1_COMPA:
+			return TIMSK1 & TIFR1 & (1 << OCF1A);
+		case SIM_TIMER1_COMPB:
+			return TIMSK1 & TIFR1 & (1 << OCF1B);
+		case SIM_TIMER1_OVF:
+			return TIMSK1 & TIFR1 & (1 << TOV1);
+		case SIM_TIMER0_COMPA:
+			return TIMSK0 & TIFR0 & (1 << OCF0A);
+		case SIM_TIMER0_COMPB:
+			return TIMSK0 & TIFR0 & (1 << OCF0B);
+		case SIM_TIMER0_OVF:
+			return TIMSK0 & TIFR0 & (1 << TOV0);
+		case SIM_USART_RX:
+			return BIT_IS_SET(UCSR0B, RXCIE0) && rxCount;
+		case SIM_USART_UDRE:
+			return BIT_IS_SET(UCSR0B, UDRIE0) && !txBufferFull;
+		case SIM_USART_TX:
+			return BIT_IS_SET(UCSR0B, TXCIE0) && BIT_IS_SET(UCSR0A, TXC0);
+		case SIM_ADC:
+			return BIT_IS_SET(ADCSRA, ADIE) && BIT_IS_SET(ADCSRA, ADIF);
+		default:
+			return 0;
+	}
+}
+
+// Flags the hardware clears when it jumps to the vector
+static void enter(uint8_t vector)
+{
+	switch (vector)
+	{
+		case SIM_TIMER2_COMPA: CLEAR_BIT(TIFR2, OCF2A); break;
+		case SIM_TIMER2_COMPB: CLEAR_BIT(TIFR2, OCF2B); break;
+		case SIM_TIMER2_OVF: CLEAR_BIT(TIFR2, TOV2); break;
+		case SIM_TIMER1_COMPA: CLEAR_BIT(TIFR1, OCF1A); break;
+		case SIM_TIMER1_COMPB: CLEAR_BIT(TIFR1, OCF1B); break;
+		case SIM_TIMER1_OVF: CLEAR_BIT(TIFR1, TOV1); break;
+		case SIM_TIMER0_COMPA: CLEAR_BIT(TIFR0, OCF0A); break;
+		case SIM_TIMER0_COMPB: CLEAR_BIT(TIFR0, OCF0B); break;
+		case SIM_TIMER0_OVF: CLEAR_BIT(TIFR0, TOV0); break;
+		case SIM_ADC: CLEAR_BIT(ADCSRA, ADIF); break;
+		default: break;
+	}
+}
+
+// Flags cleared by what the handler did (reading UDR0, ...)
+static void acknowledge(uint8_t vector)
+{
+	switch (vector)
+	{
+		case SIM_USART_RX:
+			uartConsumeRx();
+			break;
+		case SIM_USART_TX:
+			CLEAR_BIT(UCSR0A, TXC0);
+			break;
+		default:
+			break;
+	}
+}
+
+// Service pending interrupts, highest priority first, while I is set
+static void dispatch()
+{
+	if (inDispatch) return;
+	inDispatch = 1;
+
+	uint8_t vector = 0;
+	while (BIT_IS_SET(SREG, SREG_I) && vector < SIM_NUM_VECTORS)
+	{
+		uartSync();
+		if (!vectorTable[vector] || !pending(vector))
+		{
+			vector++;
+			continue;
+		}
+
+		CLEAR_BIT(SREG, SREG_I);
+		enter(vector);
+		vcdChange(simCycle, VCD_ISR + vector, 1);
+		vcdTraced[VCD_ISR + vector] = 1;
+		vectorTable[vector]();
+		uartSync();
+		adcSync();
+		pinSync();
+		acknowledge(vector);
+		simIsrCount[vector]++;
+		isrTotal++;
+		simAdvance(simIsrCycles[vector]);
+		vcdChange(simCycle, VCD_ISR + vector, 0);
+		SET_BIT(SREG, SREG_I);
+
+		vector = 0; // Rescan from the highest priority
+	}
+
+	inDispatch = 0;
+}
+
+void simSei()
+{
+	SET_BIT(SREG, SREG_I);
+	dispatch();
+}
+
+void simCli()
+{
+	CLEAR_BIT(SREG, SREG_I);
+}
+
+/* --------------- Clock --------------- */
+static void (*clockHandler)(void) = NULL;
+static uint32_t clockLeft = 0;		// Cycles until the next call
+
+void simSetClockHandler(uint32_t period, void (*handler)(void))
+{
+	clockHandler = handler;
+	clockLeft = period;
+}
+
+// Cycles until the next peripheral event
+static uint64_t nextEvent(uint64_t limit)
+{
+	if (clockHandler && clockLeft < limit) limit = clockLeft;
+	if (txShiftBusy && txShiftLeft < limit) limit = txShiftLeft;
+	if (adcConverting && adcLeft < limit) limit = adcLeft;
+	if (rxSource && rxSourceLeft < limit) limit = rxSourceLeft;
+	for (uint8_t n = 0; n < 3; n++)
+	{
+		uint64_t timer = timerCyclesToEvent(n);
+		if (timer < limit) limit = timer;
+	}
+	return limit;
+}
+
+void simAdvance(uint64_t cycles)
+{
+	uartSync();
+	adcSync();
+	pinSync();
+	dispatch();
+
+	while (cycles)
+	{
+		uint64_t step = nextEvent(cycles);
+		if (step == 0) step = 1;
+
+		simCycle += step;
+		cycles -= step;
+		uartAdvance(step);
+		uartRxAdvance(step);
+		adcAdvance(step);
+		for (uint8_t n = 0; n < 3; n++)
+		{
+			timerAdvance(n, simCycle - step, simCycle);
+		}
+		if (clockHandler)
+		{
+			// Handler may set a new period (or none)
+			if (step < clockLeft) clockLeft -= step;
+			else
+			{
+				void (*handler)(void) = clockHandler;
+				clockLeft = 0;
+				handler();
+				if (clockLeft == 0) clockHandler = NULL;
+			}
+		}
+
+		dispatch();
+	}
+}
+
+// Idle until the next interrupt has been serviced
+// Gives up after a simulated second if nothing is enabled to wake the CPU
+void simSleep()
+{
+	uint32_t serviced = isrTotal;
+	uint64_t start = simCycle;
+
+	while (isrTotal == serviced && simCycle - start < F_CPU)
+	{
+		uint64_t step = nextEvent(F_CPU);
+		if (step == 0) step = 1;
+
+		simSleepCycles += step;
+		simAdvance(step);
+	}
+}
@@ -0,0 +1,98 @@
+// Simulated ATmega328P peripherals for host builds of the firmware
+// Time is counted in CPU cycles. Firmware code itself runs in zero simulated
+// time; only busy waits (_delay_ms/_delay_us), explicit simAdvance() calls
+// and the estimated cost of each interrupt move the clock forward.
+#ifndef HOST_SIM_AVR_H
+#define HOST_SIM_AVR_H
+
+#include <stdint.h>
+
+#ifndef F_CPU
+#define F_CPU	16000000UL
+#endif
+#define SIM_PIN_WRITE_CYCLES	2 // VCD trace: cycles between pin writes made while the clock stands still
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Interrupt vectors, in hardware priority order (lowest number wins)
+enum simVector {
+	SIM_TIMER2_COMPA = 0,
+	SIM_TIMER2_COMPB,
+	SIM_TIMER2_OVF,
+	SIM_TIMER1_COMPA,
+	SIM_TIMER1_COMPB,
+	SIM_TIMER1_OVF,
+	SIM_TIMER0_COMPA,
+	SIM_TIMER0_COMPB,
+	SIM_TIMER0_OVF,
+	SIM_USART_RX,
+	SIM_USART_UDRE,
+	SIM_USART_TX,
+	SIM_ADC,
+	SIM_NUM_VECTORS
+};
+
+// Datasheet name of each vector, without _vect
+extern const char* const simVectorNames[SIM_NUM_VECTORS];
+
+// CPU cycles since reset
+extern uint64_t simCycle;
+// Of those, cycles spent asleep in sleep_mode()
+extern uint64_t simSleepCycles;
+// and in _delay_ms()/_delay_us() busy waits (interrupts taken during them not included)
+extern uint64_t simDelayCycles;
+// Times each vector has been serviced
+extern uint32_t simIsrCount[SIM_NUM_VECTORS];
+// Estimated cycles charged per interrupt (entry, body, reti)
+extern uint16_t simIsrCycles[SIM_NUM_VECTORS];
+
+// Run the peripherals for a number of CPU cycles
+void simAdvance(uint64_t cycles);
+
+// sleep_mode(): run until an interrupt has been serviced
+void simSleep(void);
+
+// Global interrupt enable (SREG I bit)
+void simSei(void);
+void simCli(void);
+
+// Called after firmware code has changed PORTB/C/D or DDRB/C/D
+void simSetPinHandler(void (*handler)(void));
+
+// ADC input: 10 bit result a conversion of the channel gives
+void simSetAdc(uint8_t channel, uint16_t value);
+
+// Value change dump (VCD, for GTKWave) of the port pins, the USART lines
+// bit by bit and as characters, and each interrupt handler running, from
+// now until simVcdClose() writes it out. Pin changes made while the clock
+// stands still (inside a handler, or between two waits) are spaced
+// SIM_PIN_WRITE_CYCLES apart in the order they were made. Returns 0 if the
+// file can't be created
+int simVcdOpen(const char* path);
+void simVcdClose(void);
+
+// Called once period cycles have passed (several simulated devices step
+// in lockstep with it); it calls simSetClockHandler() again for the next
+// period, otherwise it is not called any more
+void simSetClockHandler(uint32_t period, void (*handler)(void));
+
+// UART wiring
+// Called with each character (9 bits) as its stop bit leaves the TX pin
+void simSetTxHandler(void (*handler)(uint16_t data));
+// Deliver a character whose stop bit has just arrived on the RX pin
+void simReceive(uint16_t data);
+// Characters arriving back-to-back: source() gives each one as its stop bit
+// arrives, one character time apart, until it is set back to NULL
+void simSetRxSource(uint16_t (*source)(void));
+// CPU cycles one character occupies on the wire at the current settings
+uint32_t simUartCharCycles(void);
+// Nothing left in UDR0 or the transmit shift register
+int simUartTxIdle(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
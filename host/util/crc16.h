@@ -0,0 +1,22 @@
+// Host stand-in for <util/crc16.h>
+// Same results as the avr-libc inline assembly, from the C equivalents in
+// its documentation.
+#ifndef HOST_UTIL_CRC16_H
+#define HOST_UTIL_CRC16_H
+
+#include <stdint.h>
+
+// CRC-8, polynomial x^8 + x^2 + x + 1 (0x07), most significant bit first
+static inline uint8_t _crc8_ccitt_update(uint8_t inCrc, uint8_t inData)
+{
+	uint8_t data = inCrc ^ inData;
+
+	for (uint8_t i = 0; i < 8; i++)
+	{
+		if ((data & 0x80) != 0) data = (data << 1) ^ 0x07;
+		else data <<= 1;
+	}
+	return data;
+}
+
+#endif
@@ -0,0 +1,25 @@
+// Host stand-in for <util/delay.h>
+// Busy waits become simulated time: the peripherals (and any enabled
+// interrupts) keep running for the requested number of CPU cycles.
+// A wait counts towards simDelayCycles once it is over, so a run that ends
+// inside one does not count time it never got to.
+#ifndef HOST_UTIL_DELAY_H
+#define HOST_UTIL_DELAY_H
+
+#include "../sim_avr.h"
+
+static inline void _delay_ms(double ms)
+{
+	uint64_t cycles = ms * (F_CPU / 1000.0);
+	simAdvance(cycles);
+	simDelayCycles += cycles;
+}
+
+static inline void _delay_us(double us)
+{
+	uint64_t cycles = us * (F_CPU / 1000000.0);
+	simAdvance(cycles);
+	simDelayCycles += cycles;
+}
+
+#endif